@@ -0,0 +1,27 @@
+#!/bin/bash
+# Export throughput per worker count: average time of RUNS runs of JSON and CSV
+# export of TASKS tasks with 200-char notes for each of THREADS workers. Output
+# of every count must match the single-worker one byte for byte.
+# Usage: [TD=./td] [RUNS=3] [THREADS="1 2 4 8 16"] bench/export.sh [TASKS]
+set -e
+. "$(dirname "$0")/../tests/lib.sh"
+TASKS=${1:-5000000}
+RUNS=${RUNS:-3}
+THREADS=${THREADS:-"1 2 4 8 16"}
+export RUNS
+setup_work
+cd "$HOME"
+
+seed_tasks "$TASKS" "'task ' || i" "substr(hex(randomblob(100)), 1, 200)"
+echo "$TASKS tasks, $(nproc) CPUs"
+
+for format in json csv; do
+    TD_EXPORT_THREADS=1 "$TD" -e $format >"$WORK/reference"
+    for n in $THREADS; do
+        TD_EXPORT_THREADS=$n "$TD" -e $format >"$WORK/out"
+        cmp -s "$WORK/reference" "$WORK/out" ||
+            fail "$format export with $n threads differs from 1 thread"
+        printf '%-24s %s ms\n' "export $format, $n threads" \
+            "$(TD_EXPORT_THREADS=$n time_runs "$TD" -e $format)"
+    done
+done
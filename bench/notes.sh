@@ -0,0 +1,30 @@
+#!/bin/bash
+# List throughput and page reads of `tasks` before and after migration v2,
+# which moves notes out of it. Builds a database with the original schema,
+# TASKS tasks each with a NOTE_BYTES note, and lets td migrate it.
+# Usage: [TD=./td] [RUNS=10] bench/notes.sh [TASKS] [NOTE_BYTES]
+set -e
+. "$(dirname "$0")/../tests/lib.sh"
+TASKS=${1:-20000}
+NOTE_BYTES=${2:-2000}
+setup_work
+
+sqlite3 "$DB" "CREATE TABLE tasks
+    (id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT, note TEXT);"
+seed_tasks "$TASKS" "'task ' || i" \
+    "substr(hex(randomblob($NOTE_BYTES)), 1, $NOTE_BYTES)"
+
+# Print b-tree pages of `tasks`, pages read by the list query and its time
+measure() {
+    local pages misses ms
+    pages=$(sqlite3 "$DB" "SELECT count(*) FROM dbstat WHERE name='tasks';")
+    misses=$(sqlite3 "$DB" ".stats on" "SELECT id, name FROM tasks;" |
+        awk -F: '/Page cache misses/ { gsub(/ /, "", $2); print $2 }')
+    ms=$(time_runs sqlite3 "$DB" "SELECT id, name FROM tasks;")
+    echo "$1: tasks pages $pages, list query reads $misses pages, $ms ms"
+}
+
+measure "before v2"
+"$TD" >/dev/null
+measure "after v2"
+echo "td list: $(time_runs "$TD") ms"
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Startup overhead of recurring tasks: td list time with no schedules, with
+# SCHEDULES schedules none of which is due, and the run that materializes all
+# of them at once.
+# Usage: [TD=./td] [RUNS=10] bench/schedules.sh [SCHEDULES]
+set -e
+. "$(dirname "$0")/../tests/lib.sh"
+SCHEDULES=${1:-5000}
+setup_work
+
+"$TD" >/dev/null
+echo "no schedules: $(time_runs "$TD") ms"
+
+sqlite3 "$DB" "INSERT INTO schedules (name, note, period, next_due)
+    SELECT 'schedule ' || i, NULL, 86400 * (1 + i % 30),
+    CAST(strftime('%s', 'now') AS INTEGER) + 86400 * (1 + i % 30)
+    FROM ($(series "$SCHEDULES"));"
+echo "$SCHEDULES schedules, none due: $(time_runs "$TD") ms"
+
+sqlite3 "$DB" "UPDATE schedules SET next_due=next_due-86400*40;"
+echo "$SCHEDULES schedules, all due: $(RUNS=1 time_runs "$TD") ms"
+echo "after materializing: $(time_runs "$TD") ms," \
+    "$(sqlite3 "$DB" "SELECT count(*) FROM tasks;") tasks"
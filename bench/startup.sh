@@ -0,0 +1,48 @@
+#!/bin/bash
+# Startup cost per command: average time of RUNS runs of each command against
+# a scratch database of TASKS tasks.
+# Usage: [TD=./td] [RUNS=20] bench/startup.sh [TASKS]
+set -e
+. "$(dirname "$0")/../tests/lib.sh"
+TASKS=${1:-1000}
+RUNS=${RUNS:-20}
+export RUNS
+setup_work
+
+seed_tasks "$TASKS" "'task ' || i" "'note'"
+"$TD" -t add 1 bench >/dev/null
+mkdir -p "$WORK/peer/.td"
+(cd "$WORK/peer" && "$TD" >/dev/null)
+
+# every command is timed in a subshell, so `next` restarts per command and
+# drop takes ids from the end to leave amended ones alone
+next=0
+push() { echo "pushed $((++next))" | "$TD" -p; }
+drop() { "$TD" -n -d $((TASKS - next++)); }
+amend() { printf 'a\namended\n' | "$TD" -n -a $((++next)); }
+recur() { printf 'recurring\n\n' | "$TD" -r 7; }
+unrecur() { "$TD" -u $((++next)); }
+
+bench() {
+    printf '%-24s %s ms\n' "$1" "$(time_runs "${@:2}")"
+}
+
+bench "help" "$TD" -h
+bench "version" "$TD" -v
+bench "list" "$TD"
+bench "info" "$TD" -i 1
+bench "push" push
+bench "amend" amend
+bench "drop" drop
+bench "recur" recur
+bench "schedules" "$TD" -S
+bench "unrecur" unrecur
+bench "tag add" "$TD" -t add 2 a,b
+bench "tag rm" "$TD" -t rm 2 a,b
+bench "filter" "$TD" -f bench
+bench "report" "$TD" -R
+bench "check-report" "$TD" -C
+bench "export json" "$TD" -e json
+bench "export csv" "$TD" -e csv
+bench "sync" "$TD" -s "$WORK/peer/.td/td_data.db"
+bench "new-replica" "$TD" -N
@@ -0,0 +1,28 @@
+#!/bin/bash
+# Tag filter against the old naming convention on TASKS tasks: every task has
+# tag 'common' and a '[common]' name prefix, every 1000th one 'rare', every
+# 3rd one 'mid'. Compares `td -f` with `td | grep` for a single tag and a pair.
+# Usage: [TD=./td] [RUNS=10] bench/tags.sh [TASKS]
+set -e
+. "$(dirname "$0")/../tests/lib.sh"
+TASKS=${1:-1000000}
+setup_work
+
+seed_tasks "$TASKS" "'[common]' || iif(i%1000=0, ' [rare]', '')
+    || iif(i%3=0, ' [mid]', '') || ' task ' || i"
+seed_tag common 1
+seed_tag rare "id%1000=0"
+seed_tag mid "id%3=0"
+
+grep_rare() { "$TD" | grep -F '[rare]'; }
+grep_pair() { "$TD" | grep -F '[rare]' | grep -F '[mid]'; }
+
+expect_eq "$("$TD" -f rare | wc -l)" "$(grep_rare | wc -l)" "rare tasks"
+expect_eq "$("$TD" -f rare,mid | wc -l)" "$(grep_pair | wc -l)" "rare,mid tasks"
+echo "$("$TD" -f rare | wc -l) tasks tagged rare:"
+echo "    td -f rare: $(time_runs "$TD" -f rare) ms"
+echo "    td | grep: $(time_runs grep_rare) ms"
+echo "$("$TD" -f rare,mid | wc -l) tasks tagged rare and mid:"
+echo "    td -f rare,mid: $(time_runs "$TD" -f rare,mid) ms"
+echo "    td -f common,rare,mid: $(time_runs "$TD" -f common,rare,mid) ms"
+echo "    td | grep | grep: $(time_runs grep_pair) ms"
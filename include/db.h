@@ -4,6 +4,9 @@
 #include "sqlite3.h"
 
 int locate_db(char** db_pathname);
+int db_init(sqlite3** db, const char* db_name);
+int db_init_existing(sqlite3** db, const char* db_name);
+int db_open_ro(sqlite3** db, const char* db_name);
 int create_td_dir(const char* pathname);
 int local_db_init();
 int handle_rc(int rc, sqlite3* db);
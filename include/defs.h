@@ -11,9 +11,16 @@
 #define UNUSED(x) UNUSED_##x
 #endif
 
-// Limits
+// Limits, override at compile time, e.g. `make LIMITS=-DLINE_LEN=80`
+#ifndef LINE_LEN
 #define LINE_LEN 40
+#endif
+#ifndef LINE_LEN_EXT
 #define LINE_LEN_EXT 200
+#endif
+#if LINE_LEN <= 0 || LINE_LEN_EXT <= 0
+#error "LINE_LEN and LINE_LEN_EXT must be positive"
+#endif
 
 // 4 bytes in UTF-8
 #define MB_MAX 4
@@ -26,16 +33,39 @@
 typedef enum {
     NullCmd = 0,
     ListCmd,
-    InfoCmd,
     PushCmd,
-    AmendCmd,
+    InfoCmd,
     DropCmd,
+    AmendCmd,
     LocalCmd,
+    SyncCmd,
+    ReplicaCmd,
+    RecurCmd,
+    SchedulesCmd,
+    UnrecurCmd,
+    TagCmd,
+    FilterCmd,
+    ReportCmd,
+    CheckReportCmd,
+    ExportCmd,
+    HelpCmd,
+    VersionCmd,
+    CommandCount,
 } eCommandType;
 
+// How a command uses task database
+typedef enum {
+    DbNone = 0,  // doesn't touch it
+    DbRead,      // read-only connection is enough
+    DbWrite,
+} eDbMode;
+
 typedef struct {
     eCommandType type;
     char* arg;
+    // positional arguments left after options
+    char** args;
+    int nargs;
 } Command;
 
 struct Config {
@@ -0,0 +1,8 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "sqlite3.h"
+
+int export_tasks(sqlite3* db, const char* format);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "sqlite3.h"
+
+int report(sqlite3* db);
+int check_report(sqlite3* db);
+
+#endif
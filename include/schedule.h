@@ -0,0 +1,19 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdbool.h>
+
+#include "sqlite3.h"
+
+// Longest period of a recurring task, keeps due times far from overflow
+#define SCHEDULE_DAYS_MAX 36500
+
+int parse_days(const char* days);
+int push_schedule(sqlite3* db, const char* name, const char* note,
+                  const char* days);
+int list_schedules(sqlite3* db);
+int drop_schedule(sqlite3* db, const char* id);
+int schedules_due(sqlite3* db, bool* due);
+int materialize_schedules(sqlite3* db);
+
+#endif
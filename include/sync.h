@@ -0,0 +1,9 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "sqlite3.h"
+
+int sync_db(sqlite3* db, const char* peer_name);
+int new_replica(sqlite3* db);
+
+#endif
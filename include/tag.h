@@ -0,0 +1,14 @@
+#ifndef TAG_H
+#define TAG_H
+
+#include "sqlite3.h"
+
+// Separators of tags in filter: all of them or any of them must match
+#define TAG_SEP_ALL ","
+#define TAG_SEP_ANY "/"
+
+int tag_task(sqlite3* db, const char* id, char* tags);
+int untag_task(sqlite3* db, const char* id, char* tags);
+int filter_tasks(sqlite3* db, char* filter);
+
+#endif
@@ -36,7 +36,8 @@ int handle_exec_rc(int rc, char* errmsg) {
 /* Create directory with read-write owner permissions specified by
  * `pathname`. Returns non-zero value on error, and zero otherwise. */
 int create_dir(const char* pathname) {
-    if (mkdir(pathname, S_IRUSR + S_IWUSR) != 0) {
+    // search permission is needed to create files inside
+    if (mkdir(pathname, S_IRWXU) != 0) {
         error("Couldn't create directory '%s'\n", pathname);
         return 1;
     }
@@ -45,12 +46,12 @@ int create_dir(const char* pathname) {
 
 /* Find location of .td directory, which stands for td database, and write it as
  * a string to `db_pathname`. If directory is not found, this function creates
- * it at user's home directory. Returns non-zero value on error, and zero
- * otherwise. */
+ * it at user's home directory. `db_pathname` must be freed by caller. Returns
+ * non-zero value on error, and zero otherwise. */
 int locate_db(char** db_pathname) {
     int rc = 0;
-    char* td_dir = "/.td";
-    char* td_db = "/td_data.db";
+    const char* td_dir = "/.td";
+    const char* td_db = "/td_data.db";
     char cwd[PATH_MAX] = {};
     if (getcwd(cwd, sizeof(cwd)) == NULL) {
         error("Couldn't get current directory\n");
@@ -63,29 +64,39 @@ int locate_db(char** db_pathname) {
         defer(rc, 1);
     }
 
-    strncat(cwd, td_dir, strlen(td_dir));
     struct stat st;
     while (true) {
-        if (stat(cwd, &st) == -1) {
-            // move upwards
-            mbstr_delim_right(cwd, '/');
-            if (strcmp(cwd, home) == 0) {
-                // not found
-                strncat(cwd, td_dir, strlen(td_dir));
-                break;
+        size_t len = strlen(cwd);
+        if (len + strlen(td_dir) + strlen(td_db) >= sizeof(cwd)) {
+            error("Path '%s' is too long\n", cwd);
+            defer(rc, 1);
+        }
+        strcat(cwd, td_dir);
+        if (stat(cwd, &st) == 0) break;  // found
+
+        // move upwards, stopping at home or root directory
+        cwd[len] = '\0';
+        if (len == 0 || strcmp(cwd, home) == 0) {
+            // not found
+            int n = snprintf(cwd, sizeof(cwd), "%s%s", home, td_dir);
+            if (n < 0 || (size_t)n + strlen(td_db) >= sizeof(cwd)) {
+                error("Path '%s' is too long\n", home);
+                defer(rc, 1);
             }
-            mbstr_delim_right(cwd, '/');
-            strncat(cwd, td_dir, strlen(td_dir));
-        } else {
-            // found
-            strncat(cwd, td_db, strlen(td_db));
-            *db_pathname = calloc(strlen(cwd) + 1, sizeof(char));
-            strncpy(*db_pathname, cwd, strlen(cwd));
-            defer(rc, 0);
+            // home may be off the path when td is run outside of it
+            if (stat(cwd, &st) != 0 && create_dir(cwd) != 0) defer(rc, 1);
+            break;
         }
+        mbstr_delim_right(cwd, '/');
     }
 
-    if (create_dir(cwd) != 0) defer(rc, 1);
+    strcat(cwd, td_db);
+    *db_pathname = calloc(strlen(cwd) + 1, sizeof(char));
+    if (*db_pathname == NULL) {
+        error("Out of memory\n");
+        defer(rc, 1);
+    }
+    strcpy(*db_pathname, cwd);
 defer:
     return rc;
 }
@@ -99,8 +110,334 @@ int local_db_init() {
         error("Couldn't get current directory\n");
         return 1;
     }
-    strncat(cwd, td_dir, strlen(td_dir));
+    if (strlen(cwd) + strlen(td_dir) >= sizeof(cwd)) {
+        error("Path '%s' is too long\n", cwd);
+        return 1;
+    }
+    strcat(cwd, td_dir);
     if (create_dir(cwd) != 0) return 1;
     printf("Created directory '%s'\n", cwd);
     return 0;
 }
+
+/* SQL function `legacy_uid(...)`: 16-byte uid hashed from text of its
+ * arguments with two FNV-1a passes of different offset bases. NULL and empty
+ * arguments hash alike. */
+static void legacy_uid(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+    sqlite3_uint64 h[2] = {0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL};
+    for (int i = 0; i < argc; ++i) {
+        const unsigned char* s = sqlite3_value_text(argv[i]);
+        int n = sqlite3_value_bytes(argv[i]);
+        // argument terminator keeps ("ab", "c") apart from ("a", "bc")
+        for (int j = 0; j <= n; ++j) {
+            unsigned char c = j < n ? s[j] : 0;
+            for (int k = 0; k < 2; ++k) h[k] = (h[k] ^ c) * 0x100000001b3ULL;
+        }
+    }
+    unsigned char uid[16];
+    for (int i = 0; i < 16; ++i) uid[i] = h[i / 8] >> (56 - i % 8 * 8);
+    sqlite3_result_blob(ctx, uid, sizeof(uid), SQLITE_TRANSIENT);
+}
+
+/* Schema migrations. Entry `i` upgrades database from schema version `i` to
+ * `i + 1`; version is stored in `PRAGMA user_version`. Never edit entries
+ * that shipped in a release, append new ones instead. */
+static const char* migrations[] = {
+    // v1: initial schema
+    "CREATE TABLE IF NOT EXISTS tasks"
+    "(id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "name TEXT,"
+    "note TEXT);",
+    // v2: move notes out of `tasks`, so listing doesn't read them
+    "CREATE TABLE task_notes"
+    "(task_id INTEGER PRIMARY KEY,"
+    "note TEXT NOT NULL);"
+    "INSERT INTO task_notes (task_id, note)"
+    " SELECT id, note FROM tasks WHERE note IS NOT NULL;"
+    // rebuild instead of DROP COLUMN, which leaves rows spread one per page
+    "CREATE TABLE tasks_new"
+    "(id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "name TEXT);"
+    "INSERT INTO tasks_new (id, name) SELECT id, name FROM tasks;"
+    "UPDATE sqlite_sequence SET seq="
+    " (SELECT seq FROM sqlite_sequence WHERE name='tasks')"
+    " WHERE name='tasks_new';"
+    "DROP TABLE tasks;"
+    "ALTER TABLE tasks_new RENAME TO tasks;"
+    "CREATE TRIGGER task_notes_drop AFTER DELETE ON tasks BEGIN"
+    " DELETE FROM task_notes WHERE task_id=old.id;"
+    " END;",
+    // v3: change sequence numbers and tombstones for sync
+    "CREATE TABLE sync_meta (key TEXT PRIMARY KEY, value);"
+    "INSERT INTO sync_meta (key, value) VALUES"
+    " ('replica', randomblob(16)), ('seq', 0), ('applying', 0);"
+    "CREATE TABLE sync_peers"
+    "(replica BLOB PRIMARY KEY,"
+    "recv_seq INTEGER NOT NULL);"
+    "CREATE TABLE tombstones"
+    "(uid BLOB PRIMARY KEY,"
+    "rev INTEGER NOT NULL,"
+    "origin BLOB NOT NULL,"
+    "seq INTEGER NOT NULL);"
+    "ALTER TABLE tasks ADD COLUMN uid BLOB;"
+    "ALTER TABLE tasks ADD COLUMN rev INTEGER;"
+    "ALTER TABLE tasks ADD COLUMN origin BLOB;"
+    "ALTER TABLE tasks ADD COLUMN seq INTEGER;"
+    // existing tasks get uids derived from their content and a zero origin,
+    // so copies of one database migrated separately agree on them
+    "UPDATE tasks SET uid=legacy_uid(id, name,"
+    " (SELECT note FROM task_notes WHERE task_id=tasks.id)),"
+    " rev=1, seq=id, origin=zeroblob(16);"
+    "UPDATE sync_meta SET value=(SELECT coalesce(max(seq), 0) FROM tasks)"
+    " WHERE key='seq';"
+    "CREATE UNIQUE INDEX tasks_uid ON tasks (uid);"
+    "CREATE INDEX tasks_seq ON tasks (seq);"
+    "CREATE INDEX tombstones_seq ON tombstones (seq);"
+    // Local changes get a new seq and win over older revisions. Sync sets
+    // 'applying' and writes rev/origin/seq itself.
+    "CREATE TRIGGER tasks_push AFTER INSERT ON tasks"
+    " WHEN (SELECT value FROM sync_meta WHERE key='applying')=0 BEGIN"
+    " UPDATE sync_meta SET value=value+1 WHERE key='seq';"
+    " UPDATE tasks SET uid=randomblob(16), rev=1,"
+    " origin=(SELECT value FROM sync_meta WHERE key='replica'),"
+    " seq=(SELECT value FROM sync_meta WHERE key='seq')"
+    " WHERE id=new.id;"
+    " END;"
+    "CREATE TRIGGER tasks_amend AFTER UPDATE OF name ON tasks"
+    " WHEN (SELECT value FROM sync_meta WHERE key='applying')=0 BEGIN"
+    " UPDATE sync_meta SET value=value+1 WHERE key='seq';"
+    " UPDATE tasks SET rev=rev+1,"
+    " origin=(SELECT value FROM sync_meta WHERE key='replica'),"
+    " seq=(SELECT value FROM sync_meta WHERE key='seq')"
+    " WHERE id=new.id;"
+    " END;"
+    "CREATE TRIGGER tasks_drop AFTER DELETE ON tasks"
+    " WHEN (SELECT value FROM sync_meta WHERE key='applying')=0 BEGIN"
+    " UPDATE sync_meta SET value=value+1 WHERE key='seq';"
+    " INSERT OR REPLACE INTO tombstones (uid, rev, origin, seq) VALUES"
+    " (old.uid, old.rev+1,"
+    " (SELECT value FROM sync_meta WHERE key='replica'),"
+    " (SELECT value FROM sync_meta WHERE key='seq'));"
+    " END;"
+    "CREATE TRIGGER task_notes_push AFTER INSERT ON task_notes"
+    " WHEN (SELECT value FROM sync_meta WHERE key='applying')=0 BEGIN"
+    " UPDATE sync_meta SET value=value+1 WHERE key='seq';"
+    " UPDATE tasks SET rev=rev+1,"
+    " origin=(SELECT value FROM sync_meta WHERE key='replica'),"
+    " seq=(SELECT value FROM sync_meta WHERE key='seq')"
+    " WHERE id=new.task_id;"
+    " END;"
+    "CREATE TRIGGER task_notes_amend AFTER UPDATE ON task_notes"
+    " WHEN (SELECT value FROM sync_meta WHERE key='applying')=0 BEGIN"
+    " UPDATE sync_meta SET value=value+1 WHERE key='seq';"
+    " UPDATE tasks SET rev=rev+1,"
+    " origin=(SELECT value FROM sync_meta WHERE key='replica'),"
+    " seq=(SELECT value FROM sync_meta WHERE key='seq')"
+    " WHERE id=new.task_id;"
+    " END;",
+    // v4: recurring tasks
+    "CREATE TABLE schedules"
+    "(id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "name TEXT NOT NULL,"
+    "note TEXT,"
+    "period INTEGER NOT NULL,"
+    "next_due INTEGER NOT NULL);"
+    "CREATE INDEX schedules_due ON schedules (next_due);",
+    // v5: tags, `count` is kept to start intersections from the rarest tag
+    "CREATE TABLE tags"
+    "(id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "name TEXT NOT NULL UNIQUE,"
+    "count INTEGER NOT NULL DEFAULT 0);"
+    "CREATE TABLE task_tags"
+    "(tag_id INTEGER NOT NULL,"
+    "task_id INTEGER NOT NULL,"
+    "PRIMARY KEY (tag_id, task_id)) WITHOUT ROWID;"
+    "CREATE INDEX task_tags_task ON task_tags (task_id);"
+    "CREATE TRIGGER task_tags_add AFTER INSERT ON task_tags BEGIN"
+    " UPDATE tags SET count=count+1 WHERE id=new.tag_id;"
+    " END;"
+    "CREATE TRIGGER task_tags_rm AFTER DELETE ON task_tags BEGIN"
+    " UPDATE tags SET count=count-1 WHERE id=old.tag_id;"
+    " END;"
+    "CREATE TRIGGER task_tags_drop AFTER DELETE ON tasks BEGIN"
+    " DELETE FROM task_tags WHERE task_id=old.id;"
+    " END;",
+    // v6: creation time and report aggregates. Closed tasks are tombstones,
+    // weekly buckets count both open and closed tasks by creation time.
+    "ALTER TABLE tasks ADD COLUMN created INTEGER;"
+    "ALTER TABLE tombstones ADD COLUMN created INTEGER;"
+    "CREATE TABLE report_totals"
+    "(id INTEGER PRIMARY KEY CHECK (id=0),"
+    "open INTEGER NOT NULL,"
+    "closed INTEGER NOT NULL,"
+    "dated INTEGER NOT NULL,"
+    "created_sum INTEGER NOT NULL);"
+    "INSERT INTO report_totals (id, open, closed, dated, created_sum) VALUES"
+    " (0, (SELECT count(*) FROM tasks), (SELECT count(*) FROM tombstones),"
+    " 0, 0);"
+    "CREATE TABLE report_weeks"
+    "(week TEXT PRIMARY KEY,"
+    "created INTEGER NOT NULL) WITHOUT ROWID;"
+    "DROP TRIGGER tasks_drop;"
+    "CREATE TRIGGER tasks_drop AFTER DELETE ON tasks"
+    " WHEN (SELECT value FROM sync_meta WHERE key='applying')=0 BEGIN"
+    " UPDATE sync_meta SET value=value+1 WHERE key='seq';"
+    " INSERT INTO tombstones (uid, rev, origin, seq, created) VALUES"
+    " (old.uid, old.rev+1,"
+    " (SELECT value FROM sync_meta WHERE key='replica'),"
+    " (SELECT value FROM sync_meta WHERE key='seq'), old.created);"
+    " END;"
+    "CREATE TRIGGER report_push AFTER INSERT ON tasks BEGIN"
+    " UPDATE report_totals SET open=open+1,"
+    " dated=dated+(new.created IS NOT NULL),"
+    " created_sum=created_sum+coalesce(new.created, 0);"
+    " INSERT INTO report_weeks (week, created)"
+    " SELECT date(new.created, 'unixepoch', 'weekday 0', '-6 days'), 1"
+    " WHERE new.created IS NOT NULL"
+    " ON CONFLICT (week) DO UPDATE SET created=created+1;"
+    // fires report_created below; tasks written by sync keep their creation
+    // time, even if unknown
+    " UPDATE tasks SET created=CAST(strftime('%s', 'now') AS INTEGER)"
+    " WHERE id=new.id AND new.created IS NULL"
+    " AND (SELECT value FROM sync_meta WHERE key='applying')=0;"
+    " END;"
+    "CREATE TRIGGER report_created AFTER UPDATE OF created ON tasks"
+    " WHEN old.created IS NOT new.created BEGIN"
+    " UPDATE report_totals SET"
+    " dated=dated-(old.created IS NOT NULL)+(new.created IS NOT NULL),"
+    " created_sum=created_sum-coalesce(old.created, 0)"
+    "+coalesce(new.created, 0);"
+    " UPDATE report_weeks SET created=created-1"
+    " WHERE week=date(old.created, 'unixepoch', 'weekday 0', '-6 days');"
+    " INSERT INTO report_weeks (week, created)"
+    " SELECT date(new.created, 'unixepoch', 'weekday 0', '-6 days'), 1"
+    " WHERE new.created IS NOT NULL"
+    " ON CONFLICT (week) DO UPDATE SET created=created+1;"
+    " END;"
+    "CREATE TRIGGER report_drop AFTER DELETE ON tasks BEGIN"
+    " UPDATE report_totals SET open=open-1,"
+    " dated=dated-(old.created IS NOT NULL),"
+    " created_sum=created_sum-coalesce(old.created, 0);"
+    " UPDATE report_weeks SET created=created-1"
+    " WHERE week=date(old.created, 'unixepoch', 'weekday 0', '-6 days');"
+    " END;"
+    "CREATE TRIGGER report_close AFTER INSERT ON tombstones BEGIN"
+    " UPDATE report_totals SET closed=closed+1;"
+    " INSERT INTO report_weeks (week, created)"
+    " SELECT date(new.created, 'unixepoch', 'weekday 0', '-6 days'), 1"
+    " WHERE new.created IS NOT NULL"
+    " ON CONFLICT (week) DO UPDATE SET created=created+1;"
+    " END;"
+    "CREATE TRIGGER report_close_created AFTER UPDATE OF created ON tombstones"
+    " WHEN old.created IS NOT new.created BEGIN"
+    " UPDATE report_weeks SET created=created-1"
+    " WHERE week=date(old.created, 'unixepoch', 'weekday 0', '-6 days');"
+    " INSERT INTO report_weeks (week, created)"
+    " SELECT date(new.created, 'unixepoch', 'weekday 0', '-6 days'), 1"
+    " WHERE new.created IS NOT NULL"
+    " ON CONFLICT (week) DO UPDATE SET created=created+1;"
+    " END;"
+    "CREATE TRIGGER report_reopen AFTER DELETE ON tombstones BEGIN"
+    " UPDATE report_totals SET closed=closed-1;"
+    " UPDATE report_weeks SET created=created-1"
+    " WHERE week=date(old.created, 'unixepoch', 'weekday 0', '-6 days');"
+    " END;",
+};
+
+#define SCHEMA_VERSION (int)(sizeof(migrations) / sizeof(migrations[0]))
+
+/* Get schema version of `db`. Returns -1 on error. */
+static int schema_version(sqlite3* db) {
+    int version = -1;
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, NULL);
+    if (handle_rc(rc, db)) return -1;
+    if (sqlite3_step(stmt) == SQLITE_ROW) version = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return version;
+}
+
+/* Apply pending migrations to `db` in a single transaction. Returns non-zero
+ * value on error, and zero otherwise. */
+static int migrate_db(sqlite3* db) {
+    int rc = 0;
+    char* errmsg = NULL;
+    char pragma[32] = {0};
+
+    int version = schema_version(db);
+    if (version < 0) return 1;
+    if (version >= SCHEMA_VERSION) return 0;
+
+    rc = sqlite3_create_function(db, "legacy_uid", -1,
+                                 SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+                                 legacy_uid, NULL, NULL);
+    if (handle_rc(rc, db)) return 1;
+    rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, &errmsg);
+    if (handle_exec_rc(rc, errmsg)) return 1;
+    // another process could have migrated it while we were waiting for lock
+    version = schema_version(db);
+    if (version < 0) goto rollback;
+
+    for (int i = version; i < SCHEMA_VERSION; ++i) {
+        rc = sqlite3_exec(db, migrations[i], NULL, NULL, &errmsg);
+        if (handle_exec_rc(rc, errmsg)) goto rollback;
+    }
+
+    snprintf(pragma, sizeof(pragma), "PRAGMA user_version=%d;",
+             SCHEMA_VERSION);
+    rc = sqlite3_exec(db, pragma, NULL, NULL, &errmsg);
+    if (handle_exec_rc(rc, errmsg)) goto rollback;
+    rc = sqlite3_exec(db, "COMMIT;", NULL, NULL, &errmsg);
+    if (handle_exec_rc(rc, errmsg)) goto rollback;
+    return 0;
+rollback:
+    sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+    return 1;
+}
+
+/* Open database located at `db_name` and bring its schema up to date. Returns
+ * non-zero value on error, and zero otherwise. */
+int db_init(sqlite3** db, const char* db_name) {
+    int rc = sqlite3_open_v2(db_name, db,
+                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+    if (handle_rc(rc, *db)) return 1;
+    return migrate_db(*db);
+}
+
+/* Like `db_init`, but fails if there's no database at `db_name` instead of
+ * creating it. Returns non-zero value on error, and zero otherwise. */
+int db_init_existing(sqlite3** db, const char* db_name) {
+    int rc = sqlite3_open_v2(db_name, db, SQLITE_OPEN_READWRITE, NULL);
+    if (rc == SQLITE_CANTOPEN) {
+        error("No task database at '%s'\n", db_name);
+        return 1;
+    }
+    if (handle_rc(rc, *db)) return 1;
+    return migrate_db(*db);
+}
+
+/* Open existing database located at `db_name` read-only. Fails without
+ * printing anything if database doesn't exist or its schema is out of date, so
+ * caller can fall back to `db_init`. Returns non-zero value on error, and zero
+ * otherwise. */
+int db_open_ro(sqlite3** db, const char* db_name) {
+    int rc = sqlite3_open_v2(db_name, db,
+                             SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+    if (rc == SQLITE_OK) {
+        sqlite3_stmt* stmt;
+        rc = sqlite3_prepare_v2(*db, "PRAGMA user_version;", -1, &stmt, NULL);
+        if (rc == SQLITE_OK) {
+            rc = sqlite3_step(stmt) == SQLITE_ROW &&
+                         sqlite3_column_int(stmt, 0) == SCHEMA_VERSION
+                     ? SQLITE_OK
+                     : SQLITE_ERROR;
+        }
+        sqlite3_finalize(stmt);
+    }
+    if (rc != SQLITE_OK) {
+        sqlite3_close(*db);
+        *db = NULL;
+        return 1;
+    }
+    return 0;
+}
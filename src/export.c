@@ -0,0 +1,484 @@
+#include "export.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "defs.h"
+#include "sqlite3.h"
+
+// Max number of worker threads
+#define EXPORT_THREADS_MAX 16
+// Number of task ids read by a worker at once
+#define EXPORT_CHUNK_IDS 1024
+// Number of formatted chunks waiting for writer per worker
+#define EXPORT_WINDOW 2
+// Output buffered by the single-statement export before writing it
+#define EXPORT_FLUSH_BYTES 65536
+// Formatted bytes of a chunk after which its worker hands them to the writer
+// and waits, so long notes don't grow the window without bound
+#define EXPORT_CHUNK_BYTES (2 * EXPORT_FLUSH_BYTES)
+// Largest chunk buffer kept for reuse after writing, bigger ones are freed
+#define EXPORT_BUF_KEEP (2 * EXPORT_CHUNK_BYTES)
+// Page cache of a worker connection, KiB
+#define EXPORT_CACHE_KIB "256"
+// How long a worker waits for a writer to give up its pending lock
+#define EXPORT_BUSY_MS 5000
+
+typedef enum {
+    ExportJson = 0,
+    ExportCsv,
+} eExportFormat;
+
+// Growable output buffer
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} Buffer;
+
+typedef struct {
+    Buffer buf;
+    bool ready;  // whole chunk is formatted
+    bool full;   // part of chunk is formatted, worker waits for writer
+} Chunk;
+
+// State shared by workers and writer
+typedef struct {
+    const char* db_name;
+    eExportFormat format;
+    sqlite3_int64 first_id;
+    sqlite3_int64 nchunks;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    sqlite3_int64 next;     // next chunk to read
+    sqlite3_int64 written;  // chunks written so far
+    Chunk* window;          // chunk `i` lives in `window[i % nwindow]`
+    int nwindow;
+    bool failed;
+} Export;
+
+/* Append `n` bytes of `s` to `buf`. Returns non-zero value on error, and zero
+ * otherwise. */
+static int buf_append(Buffer* buf, const char* s, size_t n) {
+    if (buf->len + n > buf->cap) {
+        size_t cap = buf->cap == 0 ? 4096 : buf->cap;
+        while (cap < buf->len + n) cap *= 2;
+        char* data = realloc(buf->data, cap);
+        if (data == NULL) {
+            error("Out of memory\n");
+            return 1;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, s, n);
+    buf->len += n;
+    return 0;
+}
+
+static int buf_puts(Buffer* buf, const char* s) {
+    return buf_append(buf, s, strlen(s));
+}
+
+/* Append text `s` to `buf` as JSON string, or `null` if `s` is NULL. Returns
+ * non-zero value on error, and zero otherwise. */
+static int json_append(Buffer* buf, const unsigned char* s) {
+    if (s == NULL) return buf_puts(buf, "null");
+    if (buf_puts(buf, "\"")) return 1;
+    const unsigned char* run = s;
+    for (; *s != '\0'; ++s) {
+        char esc[8] = {0};
+        switch (*s) {
+            case '"':
+                strcpy(esc, "\\\"");
+                break;
+            case '\\':
+                strcpy(esc, "\\\\");
+                break;
+            case '\n':
+                strcpy(esc, "\\n");
+                break;
+            case '\t':
+                strcpy(esc, "\\t");
+                break;
+            case '\r':
+                strcpy(esc, "\\r");
+                break;
+            default:
+                // UTF-8 bytes are copied as is
+                if (*s >= 0x20) continue;
+                snprintf(esc, sizeof(esc), "\\u%04x", *s);
+        }
+        if (buf_append(buf, (const char*)run, s - run)) return 1;
+        if (buf_puts(buf, esc)) return 1;
+        run = s + 1;
+    }
+    if (buf_append(buf, (const char*)run, s - run)) return 1;
+    return buf_puts(buf, "\"");
+}
+
+/* Append text `s` to `buf` as CSV field, quoting it if needed. NULL is an
+ * empty field. Returns non-zero value on error, and zero otherwise. */
+static int csv_append(Buffer* buf, const unsigned char* s) {
+    if (s == NULL) return 0;
+    if (strpbrk((const char*)s, ",\"\r\n") == NULL)
+        return buf_puts(buf, (const char*)s);
+
+    if (buf_puts(buf, "\"")) return 1;
+    for (const char* p = (const char*)s; *p != '\0'; ++p) {
+        const char* quote = strchr(p, '"');
+        if (quote == NULL) {
+            if (buf_puts(buf, p)) return 1;
+            break;
+        }
+        if (buf_append(buf, p, quote - p + 1)) return 1;
+        if (buf_puts(buf, "\"")) return 1;
+        p = quote;
+    }
+    return buf_puts(buf, "\"");
+}
+
+/* Format current row of `stmt` (id, name, note, created) to `buf`. JSON rows
+ * start with ",\n", the writer drops the first comma. Returns non-zero value
+ * on error, and zero otherwise. */
+static int format_row(Buffer* buf, sqlite3_stmt* stmt, eExportFormat format) {
+    const unsigned char* id = sqlite3_column_text(stmt, 0);
+    const unsigned char* name = sqlite3_column_text(stmt, 1);
+    const unsigned char* note = sqlite3_column_text(stmt, 2);
+    const unsigned char* created = sqlite3_column_text(stmt, 3);
+    if (sqlite3_errcode(sqlite3_db_handle(stmt)) == SQLITE_NOMEM) return 1;
+
+    if (format == ExportJson) {
+        return buf_puts(buf, ",\n{\"id\":") ||
+               buf_puts(buf, (const char*)id) ||
+               buf_puts(buf, ",\"name\":") || json_append(buf, name) ||
+               buf_puts(buf, ",\"note\":") || json_append(buf, note) ||
+               buf_puts(buf, ",\"created\":") ||
+               buf_puts(buf,
+                        created != NULL ? (const char*)created : "null") ||
+               buf_puts(buf, "}");
+    }
+    return buf_puts(buf, (const char*)id) || buf_puts(buf, ",") ||
+           csv_append(buf, name) || buf_puts(buf, ",") ||
+           csv_append(buf, note) || buf_puts(buf, ",") ||
+           csv_append(buf, created) || buf_puts(buf, "\n");
+}
+
+/* Write contents of `buf` to standard output and empty it. The first JSON row
+ * of the output, tracked by `first`, loses its leading comma. */
+static void write_buf(Buffer* buf, eExportFormat format, bool* first) {
+    if (buf->len == 0) return;
+    size_t skip = format == ExportJson && *first;
+    fwrite(buf->data + skip, 1, buf->len - skip, stdout);
+    buf->len = 0;
+    *first = false;
+}
+
+/* Export all tasks of the `db` in `format` with a single statement on the
+ * calling thread. This is the reference the parallel export must match byte
+ * for byte. Returns non-zero value on error, and zero otherwise. */
+static int export_plain(sqlite3* db, eExportFormat format) {
+    int res = 0;
+    Buffer buf = {0};
+    bool first = true;
+    sqlite3_stmt* stmt = NULL;
+    const char* sql =
+        "SELECT t.id, t.name, n.note, t.created FROM tasks t"
+        " LEFT JOIN task_notes n ON n.task_id=t.id ORDER BY t.id;";
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    fputs(format == ExportJson ? "[" : "id,name,note,created\n", stdout);
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (format_row(&buf, stmt, format)) defer(res, 1);
+        if (buf.len >= EXPORT_FLUSH_BYTES) write_buf(&buf, format, &first);
+    }
+    if (rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+    write_buf(&buf, format, &first);
+    if (format == ExportJson) fputs("\n]\n", stdout);
+defer:
+    sqlite3_finalize(stmt);
+    free(buf.data);
+    return res;
+}
+
+/* Hand formatted part of chunk in `slot` to the writer and wait until it's
+ * written. Returns non-zero value if export failed meanwhile, and zero
+ * otherwise. */
+static int hand_over(Export* ex, Chunk* slot) {
+    pthread_mutex_lock(&ex->lock);
+    slot->full = true;
+    pthread_cond_broadcast(&ex->cond);
+    while (slot->full && !ex->failed)
+        pthread_cond_wait(&ex->cond, &ex->lock);
+    bool failed = ex->failed;
+    pthread_mutex_unlock(&ex->lock);
+    return failed;
+}
+
+/* Read tasks of chunk `chunk` using `stmt` and format them to buffer of
+ * `slot`. Returns non-zero value on error, and zero otherwise. */
+static int format_chunk(Export* ex, sqlite3_stmt* stmt, sqlite3_int64 chunk,
+                        Chunk* slot) {
+    int res = 0;
+    sqlite3* db = sqlite3_db_handle(stmt);
+    sqlite3_int64 lo = ex->first_id + chunk * EXPORT_CHUNK_IDS;
+    int rc = sqlite3_bind_int64(stmt, 1, lo);
+    if (handle_rc(rc, db)) defer(res, 1);
+    rc = sqlite3_bind_int64(stmt, 2, lo + EXPORT_CHUNK_IDS);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (format_row(&slot->buf, stmt, ex->format)) defer(res, 1);
+        if (slot->buf.len >= EXPORT_CHUNK_BYTES && hand_over(ex, slot))
+            defer(res, 1);
+    }
+    if (rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+defer:
+    sqlite3_reset(stmt);
+    return res;
+}
+
+/* Worker thread: read and format chunks on its own read-only connection until
+ * all of them are taken. The connection keeps one read transaction, see
+ * `export_tasks`. */
+static void* export_worker(void* arg) {
+    Export* ex = arg;
+    sqlite3* db = NULL;
+    sqlite3_stmt* stmt = NULL;
+    bool failed = false;
+
+    const char* sql =
+        "SELECT t.id, t.name, n.note, t.created FROM tasks t"
+        " LEFT JOIN task_notes n ON n.task_id=t.id"
+        " WHERE t.id>=?1 AND t.id<?2 ORDER BY t.id;";
+    // chunks are read once, in id order, a big page cache per worker would
+    // only add up
+    const char* sql_begin = "PRAGMA cache_size=-" EXPORT_CACHE_KIB "; BEGIN;";
+    char* errmsg = NULL;
+    if (db_open_ro(&db, ex->db_name) != 0) {
+        error("Couldn't open '%s' for reading\n", ex->db_name);
+        failed = true;
+    } else if (handle_rc(sqlite3_busy_timeout(db, EXPORT_BUSY_MS), db) ||
+               handle_exec_rc(sqlite3_exec(db, sql_begin, NULL, NULL, &errmsg),
+                              errmsg) ||
+               handle_rc(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL), db)) {
+        failed = true;
+    }
+
+    while (!failed) {
+        pthread_mutex_lock(&ex->lock);
+        // don't get too far ahead of the writer
+        while (!ex->failed && ex->next < ex->nchunks &&
+               ex->next >= ex->written + ex->nwindow)
+            pthread_cond_wait(&ex->cond, &ex->lock);
+        if (ex->failed || ex->next >= ex->nchunks) {
+            pthread_mutex_unlock(&ex->lock);
+            break;
+        }
+        sqlite3_int64 chunk = ex->next++;
+        Chunk* slot = &ex->window[chunk % ex->nwindow];
+        pthread_mutex_unlock(&ex->lock);
+
+        // the slot is ours until writer takes it
+        failed = format_chunk(ex, stmt, chunk, slot) != 0;
+
+        pthread_mutex_lock(&ex->lock);
+        if (!failed) slot->ready = true;
+        pthread_cond_broadcast(&ex->cond);
+        pthread_mutex_unlock(&ex->lock);
+    }
+
+    if (failed) {
+        pthread_mutex_lock(&ex->lock);
+        ex->failed = true;
+        pthread_cond_broadcast(&ex->cond);
+        pthread_mutex_unlock(&ex->lock);
+    }
+    sqlite3_finalize(stmt);
+    // nothing was written, closing ends the read transaction
+    sqlite3_close(db);
+    return NULL;
+}
+
+/* Get number of worker threads: `TD_EXPORT_THREADS` environment variable if
+ * set, number of online CPUs otherwise. */
+static int export_threads() {
+    long n = 0;
+    const char* env = getenv("TD_EXPORT_THREADS");
+    if (env != NULL)
+        n = strtol(env, NULL, 10);
+    else
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > EXPORT_THREADS_MAX) n = EXPORT_THREADS_MAX;
+    return n;
+}
+
+/* Get range of task ids in the `db`. Writes zero to `count` if there are no
+ * tasks. Returns non-zero value on error, and zero otherwise. */
+static int id_range(sqlite3* db, sqlite3_int64* first, sqlite3_int64* count) {
+    int res = 0;
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT min(id), max(id) FROM tasks;";
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+    *first = sqlite3_column_int64(stmt, 0);
+    *count = sqlite3_column_type(stmt, 0) == SQLITE_NULL
+                 ? 0
+                 : sqlite3_column_int64(stmt, 1) - *first + 1;
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/* Check whether the `db` is in WAL mode. Writes result to `wal`. Returns
+ * non-zero value on error, and zero otherwise. */
+static int is_wal(sqlite3* db, bool* wal) {
+    int res = 0;
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, "PRAGMA journal_mode;", -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+    *wal = sqlite3_stricmp((const char*)sqlite3_column_text(stmt, 0), "wal") ==
+           0;
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/* Export tasks of `ex` with `nthreads` workers, writing chunks in order.
+ * Returns non-zero value on error, and zero otherwise. */
+static int export_parallel(Export* ex, int nthreads) {
+    int res = 0;
+    pthread_t threads[EXPORT_THREADS_MAX];
+    int started = 0;
+    bool first = true;
+
+    ex->nwindow = nthreads * EXPORT_WINDOW;
+    ex->window = calloc(ex->nwindow, sizeof(Chunk));
+    if (ex->window == NULL) {
+        error("Out of memory\n");
+        return 1;
+    }
+    pthread_mutex_init(&ex->lock, NULL);
+    pthread_cond_init(&ex->cond, NULL);
+
+    for (; started < nthreads; ++started) {
+        if (pthread_create(&threads[started], NULL, export_worker, ex) != 0) {
+            error("Couldn't start export thread\n");
+            pthread_mutex_lock(&ex->lock);
+            ex->failed = true;
+            pthread_cond_broadcast(&ex->cond);
+            pthread_mutex_unlock(&ex->lock);
+            defer(res, 1);
+        }
+    }
+
+    fputs(ex->format == ExportJson ? "[" : "id,name,note,created\n", stdout);
+    for (sqlite3_int64 i = 0; i < ex->nchunks; ++i) {
+        Chunk* slot = &ex->window[i % ex->nwindow];
+        pthread_mutex_lock(&ex->lock);
+        for (;;) {
+            while (!slot->ready && !slot->full && !ex->failed)
+                pthread_cond_wait(&ex->cond, &ex->lock);
+            if (!slot->full) break;
+            // the worker waits, so its buffer can be written without the lock
+            pthread_mutex_unlock(&ex->lock);
+            write_buf(&slot->buf, ex->format, &first);
+            pthread_mutex_lock(&ex->lock);
+            slot->full = false;
+            pthread_cond_broadcast(&ex->cond);
+        }
+        pthread_mutex_unlock(&ex->lock);
+        if (!slot->ready) defer(res, 1);
+
+        // chunks may be empty when ids have gaps
+        write_buf(&slot->buf, ex->format, &first);
+        // a row of long notes must not pin its memory for the whole export
+        if (slot->buf.cap > EXPORT_BUF_KEEP) {
+            free(slot->buf.data);
+            slot->buf = (Buffer){0};
+        }
+
+        pthread_mutex_lock(&ex->lock);
+        slot->ready = false;
+        ex->written++;
+        pthread_cond_broadcast(&ex->cond);
+        pthread_mutex_unlock(&ex->lock);
+    }
+    if (ex->format == ExportJson) fputs("\n]\n", stdout);
+defer:
+    for (int i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+    // a worker may fail after the last chunk was written
+    if (ex->failed) res = 1;
+    for (int i = 0; i < ex->nwindow; ++i) free(ex->window[i].buf.data);
+    free(ex->window);
+    pthread_mutex_destroy(&ex->lock);
+    pthread_cond_destroy(&ex->cond);
+    return res;
+}
+
+/* Export all tasks of the `db` to standard output in `format`, which is `json`
+ * or `csv`. Id space is split into chunks, which are read and formatted by
+ * worker threads, each on its own read-only connection, and written in order.
+ * With a single thread, or a database in WAL mode, `export_plain` is used
+ * instead. Output is the same either way. Returns non-zero value on error,
+ * and zero otherwise. */
+int export_tasks(sqlite3* db, const char* format) {
+    int res = 0;
+    char* errmsg = NULL;
+    Export ex = {0};
+
+    if (strcmp(format, "json") == 0)
+        ex.format = ExportJson;
+    else if (strcmp(format, "csv") == 0)
+        ex.format = ExportCsv;
+    else {
+        error("Unknown export format '%s', expected 'json' or 'csv'\n",
+              format);
+        return 1;
+    }
+
+    // The read transaction held here for the whole export keeps writers from
+    // committing in rollback journal modes, so workers see the same snapshot
+    // and the id range taken in it. In WAL mode it doesn't, and workers could
+    // see later commits than this connection.
+    int rc = sqlite3_exec(db, "BEGIN;", NULL, NULL, &errmsg);
+    if (handle_exec_rc(rc, errmsg)) return 1;
+    bool wal = false;
+    if (is_wal(db, &wal)) defer(res, 1);
+    ex.db_name = sqlite3_db_filename(db, "main");
+    sqlite3_int64 count = 0;
+    if (id_range(db, &ex.first_id, &count)) defer(res, 1);
+    ex.nchunks = (count + EXPORT_CHUNK_IDS - 1) / EXPORT_CHUNK_IDS;
+
+    int want = export_threads();
+    if (want > ex.nchunks) want = ex.nchunks;
+    if (want <= 1 || wal)
+        res = export_plain(db, ex.format);
+    else
+        res = export_parallel(&ex, want);
+defer:
+    rc = sqlite3_exec(db, "COMMIT;", NULL, NULL, &errmsg);
+    if (handle_exec_rc(rc, errmsg)) res = 1;
+    return res;
+}
@@ -2,13 +2,19 @@
 #include <locale.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "db.h"
 #include "defs.h"
+#include "export.h"
+#include "report.h"
 #include "sqlite3.h"
+#include "schedule.h"
 #include "str.h"
+#include "sync.h"
+#include "tag.h"
 #include "task.h"
 
 // change this on every release((
@@ -16,27 +22,6 @@
 
 static struct Config gconfig = {.confirm = true};
 
-void help() {
-    // clang-format off
-    printf("Usage: td [options]\n");
-    printf("Simple ToDo task manager. With no command lists all tasks.\n");
-    printf("td relies on task database, which is by default located in $HOME/.td directory. "
-            "When td is invoked, it recursively finds nearest to the current directory task database.\n");
-    printf("Starting from version v1.2.0 td supports UTF-8 string format. The only exception is confirmation. "
-            "See --no-confirm below.\n\n");
-    printf("COMMANDS:\n");
-    printf("\t-p --push Push a task to database.\n");
-    printf("\t-i --info <ID> Get information about specific task, such as note.\n");
-    printf("\t-d --drop <ID> Delete task.\n");
-    printf("\t-a --amend <ID> Amend a task's name or note.\n");
-    printf("\t-l --local Initialize task database in the current directory.\n");
-    printf("OPTIONS & HELPERS:\n");
-    printf("\t-n --no-confirm Do not confirm user before amending or deleting a task.\n");
-    printf("\t-v --version Print td's version\n");
-    printf("\t-h --help Display this help page.\n");
-    // clang-format on
-}
-
 int confirm(const char* prompt) {
     char choice[2] = {};
     // cause we accept only 1 byte. mbstr_readline won't take any effect
@@ -49,21 +34,7 @@ int confirm(const char* prompt) {
         return 1;
 }
 
-int db_init(sqlite3** db, const char* db_name) {
-    int rc = sqlite3_open_v2(db_name, db,
-                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
-    if (handle_rc(rc, *db)) return 1;
-    char* sql =
-        "CREATE TABLE IF NOT EXISTS tasks"
-        "(id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "name TEXT,"
-        "note TEXT);";
-    char* errmsg = NULL;
-    rc = sqlite3_exec(*db, sql, NULL, NULL, &errmsg);
-    return handle_exec_rc(rc, errmsg);
-}
-
-void push(sqlite3* db) {
+int push(sqlite3* db, Command* UNUSED(cmd)) {
     char name[LINE_LEN * MB_MAX + 1] = {0};
     char note[LINE_LEN_EXT * MB_MAX + 1] = {0};
     char* note_ptr = note;
@@ -75,187 +46,378 @@ void push(sqlite3* db) {
 
         if (push_task(db, name, note_ptr)) {
             error("Couldn't create task, please check your name and note\n");
-            break;
+            return 1;
         } else {
             printf("Created task '%s'\n", name);
             break;
         }
     }
+    return 0;
 }
 
-void amend(sqlite3* db, Command* cmd) {
+int amend(sqlite3* db, Command* cmd) {
     char choice[2] = {};
     char* id = cmd->arg;
 
     if (info_task(db, id) != 0) {
         error("Couldn't amend task with id '%s'\n", id);
-        return;
+        return 1;
     }
     while (true) {
         str_readline(choice, 1, "What to change: n(A)me/n(O)te: ");
         if (str_isempty(choice)) break;
 
         if (choice[0] == 'a' || choice[0] == 'A') {
-            char name[LINE_LEN + 1] = {0};
+            char name[LINE_LEN * MB_MAX + 1] = {0};
             mbstr_readline(name, LINE_LEN, "New name: ");
 
             if (gconfig.confirm) {
-                if (confirm("Amend task? (y/n) ") != 0) return;
+                if (confirm("Amend task? (y/n) ") != 0) return 0;
             }
 
             if (amend_task(db, AMEND_NAME, id, name)) {
                 error("Couldn't amend task with id '%s'\n", id);
-                return;
+                return 1;
             }
             printf("Task amended\n");
             break;
 
         } else if (choice[0] == 'o' || choice[0] == 'O') {
-            char note[LINE_LEN_EXT + 1] = {0};
+            char note[LINE_LEN_EXT * MB_MAX + 1] = {0};
             mbstr_readline(note, LINE_LEN_EXT, "New note: ");
 
             if (gconfig.confirm) {
-                if (confirm("Amend task? (y/n) ") != 0) return;
+                if (confirm("Amend task? (y/n) ") != 0) return 0;
             }
 
             if (amend_task(db, AMEND_NOTE, id, note)) {
                 error("Couldn't amend task with id '%s'\n", id);
-                break;
+                return 1;
             }
             printf("Task amended\n");
             break;
 
         } else {
             error("Invalid choice\n");
-            return;
+            return 1;
         }
     }
+    return 0;
+}
+
+int recur(sqlite3* db, Command* cmd) {
+    char name[LINE_LEN * MB_MAX + 1] = {0};
+    char note[LINE_LEN_EXT * MB_MAX + 1] = {0};
+    char* note_ptr = note;
+
+    if (parse_days(cmd->arg) < 0) {
+        error("Invalid number of days '%s', expected 1 to %d\n", cmd->arg,
+              SCHEDULE_DAYS_MAX);
+        return 1;
+    }
+    mbstr_readline(name, LINE_LEN, "Enter a name(skip to abort): ");
+    if (mbstr_isempty(name)) return 0;
+    mbstr_readline(note, LINE_LEN_EXT, "Enter a note(skip for NULL): ");
+    if (mbstr_isempty(note)) note_ptr = NULL;
+
+    if (push_schedule(db, name, note_ptr, cmd->arg)) {
+        error("Couldn't create recurring task, please check your name and "
+              "note\n");
+        return 1;
+    }
+    printf("Created task '%s' recurring every %s days\n", name, cmd->arg);
+    return 0;
 }
 
-void drop(sqlite3* db, Command* cmd) {
+int drop(sqlite3* db, Command* cmd) {
     if (gconfig.confirm) {
-        if (confirm("Delete task? (y/n) ") != 0) return;
+        if (confirm("Delete task? (y/n) ") != 0) return 0;
     }
     if (drop_task(db, cmd->arg)) {
         error("Couldn't delete task with id '%s'\n", cmd->arg);
-        return;
+        return 1;
     }
     printf("Task deleted\n");
+    return 0;
 }
 
-void parse_args(Command* cmd, int argc, char** argv) {
-    int c;
-    const char* short_options = "hpi:d:a:vnl";
+int list(sqlite3* db, Command* UNUSED(cmd)) {
+    if (list_tasks(db) != 0) {
+        error("Couldn't get information about tasks\n");
+        return 1;
+    }
+    return 0;
+}
+
+int info(sqlite3* db, Command* cmd) {
+    if (info_task(db, cmd->arg) != 0) {
+        error("Couldn't get information about task with id='%s'\n", cmd->arg);
+        return 1;
+    }
+    return 0;
+}
+
+int local(sqlite3* UNUSED(db), Command* UNUSED(cmd)) {
+    if (local_db_init() != 0) {
+        error("Couldn't initialize local database\n");
+        return 1;
+    }
+    return 0;
+}
+
+int sync_with(sqlite3* db, Command* cmd) {
+    if (sync_db(db, cmd->arg) != 0) {
+        error("Couldn't sync with '%s'\n", cmd->arg);
+        return 1;
+    }
+    return 0;
+}
+
+int replica(sqlite3* db, Command* UNUSED(cmd)) {
+    if (new_replica(db) != 0) {
+        error("Couldn't change replica id\n");
+        return 1;
+    }
+    printf("Replica id changed\n");
+    return 0;
+}
+
+int schedules(sqlite3* db, Command* UNUSED(cmd)) {
+    if (list_schedules(db) != 0) {
+        error("Couldn't get information about recurring tasks\n");
+        return 1;
+    }
+    return 0;
+}
+
+int unrecur(sqlite3* db, Command* cmd) {
+    if (drop_schedule(db, cmd->arg) != 0) {
+        error("Couldn't stop recurring task with id '%s'\n", cmd->arg);
+        return 1;
+    }
+    printf("Recurring task stopped\n");
+    return 0;
+}
+
+int tag(sqlite3* db, Command* cmd) {
+    if (cmd->nargs != 2) {
+        error("Expected task id and tags, see 'td --help'\n");
+        return 1;
+    }
+    char* id = cmd->args[0];
+    char* tags = cmd->args[1];
+    int rc = 0;
+    if (strcmp(cmd->arg, "add") == 0)
+        rc = tag_task(db, id, tags);
+    else if (strcmp(cmd->arg, "rm") == 0)
+        rc = untag_task(db, id, tags);
+    else {
+        error("Invalid tag action '%s', expected 'add' or 'rm'\n", cmd->arg);
+        return 1;
+    }
+    if (rc != 0) {
+        error("Couldn't change tags of task with id '%s'\n", id);
+        return 1;
+    }
+    printf("Tags changed\n");
+    return 0;
+}
 
+int filter(sqlite3* db, Command* cmd) {
+    if (filter_tasks(db, cmd->arg) != 0) {
+        error("Couldn't get information about tasks\n");
+        return 1;
+    }
+    return 0;
+}
+
+int stats(sqlite3* db, Command* UNUSED(cmd)) {
+    if (report(db) != 0) {
+        error("Couldn't get task statistics\n");
+        return 1;
+    }
+    return 0;
+}
+
+int check_stats(sqlite3* db, Command* UNUSED(cmd)) {
+    // mismatches are reported by check_report itself
+    return check_report(db);
+}
+
+int export(sqlite3* db, Command* cmd) {
+    if (export_tasks(db, cmd->arg) != 0) {
+        error("Couldn't export tasks\n");
+        return 1;
+    }
+    return 0;
+}
+
+int help(sqlite3* db, Command* cmd);
+
+int version(sqlite3* UNUSED(db), Command* UNUSED(cmd)) {
+    printf("td " VERSION "\n");
+    printf("run 'td --help' to get help\n");
+    return 0;
+}
+
+typedef struct {
+    const char* name;  // long option, NULL if command has no option
+    char short_name;
+    bool has_arg;
+    eDbMode db;
+    int (*run)(sqlite3* db, Command* cmd);
+    const char* help;  // NULL to leave it out of COMMANDS section
+    bool immediate;    // runs right away, regardless of other options
+} CommandSpec;
+
+// clang-format off
+static const CommandSpec commands[CommandCount] = {
+    [ListCmd] = {NULL, 0, false, DbRead, list, NULL},
+    [PushCmd] = {"push", 'p', false, DbWrite, push,
+        "Push a task to database."},
+    [InfoCmd] = {"info", 'i', true, DbRead, info,
+        "<ID> Get information about specific task, such as note."},
+    [DropCmd] = {"drop", 'd', true, DbWrite, drop,
+        "<ID> Delete task."},
+    [AmendCmd] = {"amend", 'a', true, DbWrite, amend,
+        "<ID> Amend a task's name or note."},
+    [LocalCmd] = {"local", 'l', false, DbNone, local,
+        "Initialize task database in the current directory."},
+    [SyncCmd] = {"sync", 's', true, DbWrite, sync_with,
+        "<PATH> Exchange changes with another task database."},
+    [ReplicaCmd] = {"new-replica", 'N', false, DbWrite, replica,
+        "Give a copied task database its own identity for --sync."},
+    [RecurCmd] = {"recur", 'r', true, DbWrite, recur,
+        "<DAYS> Push a task now and then every DAYS days."},
+    [SchedulesCmd] = {"schedules", 'S', false, DbRead, schedules,
+        "List recurring tasks."},
+    [UnrecurCmd] = {"unrecur", 'u', true, DbWrite, unrecur,
+        "<ID> Stop a recurring task."},
+    [TagCmd] = {"tag", 't', true, DbWrite, tag,
+        "<add|rm> <ID> <TAG,...> Add or remove task's tags."},
+    [FilterCmd] = {"filter", 'f', true, DbRead, filter,
+        "<TAG,...|TAG/...> List tasks having all ',' or any '/' of the tags."},
+    [ReportCmd] = {"report", 'R', false, DbRead, stats,
+        "Print statistics of open and closed tasks."},
+    [CheckReportCmd] = {"check-report", 'C', false, DbRead, check_stats,
+        "Verify statistics against a full recount of tasks."},
+    [ExportCmd] = {"export", 'e', true, DbRead, export,
+        "<json|csv> Write all tasks to standard output."},
+    [HelpCmd] = {"help", 'h', false, DbNone, help, NULL, true},
+    [VersionCmd] = {"version", 'v', false, DbNone, version, NULL, true},
+};
+// clang-format on
+
+int help(sqlite3* UNUSED(db), Command* UNUSED(cmd)) {
     // clang-format off
-    struct option long_options[] = {
+    printf("Usage: td [options]\n");
+    printf("Simple ToDo task manager. With no command lists all tasks.\n");
+    printf("td relies on task database, which is by default located in $HOME/.td directory. "
+            "When td is invoked, it recursively finds nearest to the current directory task database.\n");
+    printf("Starting from version v1.2.0 td supports UTF-8 string format. The only exception is confirmation. "
+            "See --no-confirm below.\n\n");
+    printf("COMMANDS:\n");
+    for (int i = 0; i < CommandCount; ++i) {
+        const CommandSpec* spec = &commands[i];
+        if (spec->name == NULL || spec->help == NULL) continue;
+        printf("\t-%c --%s %s\n", spec->short_name, spec->name, spec->help);
+    }
+    printf("OPTIONS & HELPERS:\n");
+    printf("\t-n --no-confirm Do not confirm user before amending or deleting a task.\n");
+    printf("\t-v --version Print td's version\n");
+    printf("\t-h --help Display this help page.\n");
+    // clang-format on
+    return 0;
+}
+
+void parse_args(Command* cmd, int argc, char** argv) {
+    int c;
+    // every command takes at most 2 characters, plus -n and '\0'
+    char short_options[CommandCount * 2 + 2] = "n";
+    struct option long_options[CommandCount + 2] = {
         {"no-confirm", no_argument, 0, 'n'},
-        {"version", no_argument, 0, 'v'},
-        {"help", no_argument, 0, 'h'},
-        {"push", no_argument, 0, 'p'},
-        {"info", required_argument, 0, 'i'},
-        {"amend", required_argument, 0, 'a'},
-        {"drop", required_argument, 0, 'd'},
-        {"local", no_argument, 0, 'l'},
-        {0, 0, 0, 0}
     };
-    // clang-format on
+    size_t s = strlen(short_options);
+    int l = 1;
+    for (int i = 0; i < CommandCount; ++i) {
+        const CommandSpec* spec = &commands[i];
+        if (spec->name == NULL) continue;
+        short_options[s++] = spec->short_name;
+        if (spec->has_arg) short_options[s++] = ':';
+        long_options[l++] = (struct option){
+            spec->name, spec->has_arg ? required_argument : no_argument, 0,
+            spec->short_name};
+    }
 
     cmd->type = ListCmd;
     while (true) {
         c = getopt_long(argc, argv, short_options, long_options, NULL);
         if (c == -1) break;
 
-        switch (c) {
-            // helper/util commands & options
-            case 'h':
-                cmd->type = NullCmd;
-                help();
-                return;
-            case 'v':  // version
-                cmd->type = NullCmd;
-                printf("td " VERSION "\n");
-                printf("run 'td --help' to get help\n");
-                return;
-            case 'n':
-                gconfig.confirm = false;
-                break;
-
-            // UX commands
-            case 'p':
-                cmd->type = PushCmd;
-                break;
-            case 'i':
-                cmd->type = InfoCmd;
-                cmd->arg = optarg;
-                break;
-            case 'a':
-                cmd->type = AmendCmd;
-                cmd->arg = optarg;
-                break;
-            case 'd':
-                cmd->type = DropCmd;
-                cmd->arg = optarg;
-                break;
-            case 'l':
-                cmd->type = LocalCmd;
-                break;
-
-            // error-handling cases
-            case '?':
-                cmd->type = NullCmd;
-                break;
-            default:
-                cmd->type = NullCmd;
-                error(
-                    "Getopt returned unknown character code '%d'. please check "
-                    "your command line arguments\n",
-                    c);
-                break;
+        if (c == 'n') {
+            gconfig.confirm = false;
+            continue;
+        }
+        if (c == '?') {
+            cmd->type = NullCmd;
+            return;
+        }
+
+        int i = 0;
+        while (i < CommandCount && (commands[i].name == NULL ||
+                                    commands[i].short_name != c))
+            ++i;
+        if (i == CommandCount) {
+            cmd->type = NullCmd;
+            error(
+                "Getopt returned unknown character code '%d'. please check "
+                "your command line arguments\n",
+                c);
+            return;
         }
+        cmd->type = i;
+        cmd->arg = optarg;
+        if (commands[i].immediate) return;
     }
+    cmd->args = argv + optind;
+    cmd->nargs = argc - optind;
+}
+
+/* Open task database located at `db_pathname` with access `mode`, bringing
+ * its schema and recurring tasks up to date when needed. For `DbRead` a
+ * read-only connection is used unless there's something to write. Returns
+ * non-zero value on error, and zero otherwise. */
+int open_db(sqlite3** db, const char* db_pathname, eDbMode mode) {
+    if (mode == DbRead && db_open_ro(db, db_pathname) == 0) {
+        bool due = false;
+        if (schedules_due(*db, &due)) return 1;
+        if (!due) return 0;
+        sqlite3_close(*db);
+        *db = NULL;
+    }
+    if (db_init(db, db_pathname)) return 1;
+    if (materialize_schedules(*db)) {
+        error("Couldn't push recurring tasks\n");
+        return 1;
+    }
+    return 0;
 }
 
 int dispatch_command(Command* cmd) {
     int rc = 0;
     sqlite3* db = NULL;
     char* db_pathname = NULL;
-    if (locate_db(&db_pathname)) defer(rc, 1);
-    if (db_init(&db, db_pathname)) defer(rc, 1);
-
-    switch (cmd->type) {
-        case ListCmd:
-            if (list_tasks(db) != 0) {
-                error("Couldn't get information about tasks\n");
-                defer(rc, 1);
-            }
-            break;
-        case InfoCmd:
-            if (info_task(db, cmd->arg) != 0) {
-                error("Couldn't get information about task with id='%s'\n",
-                      cmd->arg);
-                defer(rc, 1);
-            }
-            break;
-        case PushCmd:
-            push(db);
-            break;
-        case AmendCmd:
-            amend(db, cmd);
-            break;
-        case DropCmd:
-            drop(db, cmd);
-            break;
-        case LocalCmd:
-            if (local_db_init() != 0) {
-                error("Couldn't initialize local database\n");
-                defer(rc, 1);
-            }
-            break;
-        default:
-            error("Unexpected command type\n");
-            defer(rc, 1);
+    if (cmd->type <= NullCmd || cmd->type >= CommandCount) {
+        error("Unexpected command type\n");
+        return 1;
+    }
+    const CommandSpec* spec = &commands[cmd->type];
+
+    if (spec->db != DbNone) {
+        if (locate_db(&db_pathname)) defer(rc, 1);
+        if (open_db(&db, db_pathname, spec->db)) defer(rc, 1);
     }
+    rc = spec->run(db, cmd);
 defer:
     if (db != NULL) sqlite3_close(db);
     if (db_pathname != NULL) free(db_pathname);
@@ -0,0 +1,107 @@
+#include "report.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "db.h"
+#include "defs.h"
+#include "sqlite3.h"
+
+#define SECONDS_PER_DAY 86400
+
+/* Print task statistics of the `db`: open and closed tasks, average age of
+ * open tasks and tasks created per week. Statistics are read from aggregates
+ * maintained by triggers, so cost doesn't depend on number of tasks. Returns
+ * non-zero error code if an error occurs, zero otherwise. */
+int report(sqlite3* db) {
+    int res = 0;
+    sqlite3_stmt* stmt;
+    const char* sql =
+        "SELECT open, closed, dated, created_sum FROM report_totals;";
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    rc = sqlite3_step(stmt);
+    if (rc != SQLITE_ROW) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+    sqlite3_int64 dated = sqlite3_column_int64(stmt, 2);
+    printf("Open tasks: %lld\n", sqlite3_column_int64(stmt, 0));
+    printf("Closed tasks: %lld\n", sqlite3_column_int64(stmt, 1));
+    if (dated > 0) {
+        double avg_created = (double)sqlite3_column_int64(stmt, 3) / dated;
+        printf("Average age of open tasks: %.1f days\n",
+               ((double)time(NULL) - avg_created) / SECONDS_PER_DAY);
+    }
+    sqlite3_finalize(stmt);
+
+    sql = "SELECT week, created FROM report_weeks WHERE created>0;";
+    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    printf("Tasks created per week:\n");
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const unsigned char* week = sqlite3_column_text(stmt, 0);
+        if (sqlite3_errcode(db) == SQLITE_NOMEM) defer(res, 1);
+        printf("\t%s %lld\n", week, sqlite3_column_int64(stmt, 1));
+    }
+    if (rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+// Each query returns a single non-zero value if the aggregate is off
+static const char* checks[][2] = {
+    {"open tasks",
+     "SELECT open-(SELECT count(*) FROM tasks) FROM report_totals;"},
+    {"closed tasks",
+     "SELECT closed-(SELECT count(*) FROM tombstones) FROM report_totals;"},
+    {"open task ages",
+     "SELECT (dated, created_sum) IS NOT"
+     " (SELECT count(created), coalesce(sum(created), 0) FROM tasks)"
+     " FROM report_totals;"},
+    {"weekly counts",
+     "WITH recount (week, created) AS"
+     " (SELECT date(created, 'unixepoch', 'weekday 0', '-6 days'), count(*)"
+     " FROM (SELECT created FROM tasks UNION ALL"
+     " SELECT created FROM tombstones)"
+     " WHERE created IS NOT NULL GROUP BY 1),"
+     " kept (week, created) AS"
+     " (SELECT week, created FROM report_weeks WHERE created<>0)"
+     " SELECT count(*) FROM"
+     " (SELECT * FROM (SELECT * FROM recount EXCEPT SELECT * FROM kept)"
+     " UNION ALL SELECT * FROM (SELECT * FROM kept EXCEPT"
+     " SELECT * FROM recount));"},
+};
+
+/* Verify report aggregates of the `db` against a full recount of tasks and
+ * print the ones that differ. Returns non-zero value if an error occurs or
+ * any aggregate is off, zero otherwise. */
+int check_report(sqlite3* db) {
+    int res = 0;
+    sqlite3_stmt* stmt = NULL;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); ++i) {
+        int rc = sqlite3_prepare_v2(db, checks[i][1], -1, &stmt, NULL);
+        if (handle_rc(rc, db)) defer(res, 1);
+        rc = sqlite3_step(stmt);
+        if (rc != SQLITE_ROW) {
+            error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+            defer(res, 1);
+        }
+        if (sqlite3_column_int64(stmt, 0) != 0) {
+            printf("Report of %s doesn't match the tasks\n", checks[i][0]);
+            res = 1;
+        }
+        sqlite3_finalize(stmt);
+        stmt = NULL;
+    }
+    if (res == 0) printf("Report matches the tasks\n");
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
@@ -0,0 +1,243 @@
+#include "schedule.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "db.h"
+#include "defs.h"
+#include "sqlite3.h"
+#include "str.h"
+
+#define SECONDS_PER_DAY 86400
+
+/* Parse numeric string `days` as a schedule period. Returns number of days, or
+ * -1 if `days` isn't a number from 1 to `SCHEDULE_DAYS_MAX`. */
+int parse_days(const char* days) {
+    if (days == NULL || !mbstr_isnumeric(days)) return -1;
+    char* end = NULL;
+    errno = 0;
+    long n = strtol(days, &end, 10);
+    if (errno != 0 || end == days || *end != '\0') return -1;
+    if (n <= 0 || n > SCHEDULE_DAYS_MAX) return -1;
+    return (int)n;
+}
+
+/* Insert a schedule into the `db`, see `push_schedule`. Returns non-zero value
+ * on error, zero otherwise. */
+static int insert_schedule(sqlite3* db, const char* name, const char* note,
+                           int period) {
+    int res = 0;
+    sqlite3_stmt* stmt;
+    char* sql =
+        "INSERT INTO schedules (name, note, period, next_due)"
+        " VALUES (?1, ?2, ?3, ?4);";
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    rc = sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    if (handle_rc(rc, db)) defer(res, 1);
+    rc = note == NULL ? sqlite3_bind_null(stmt, 2)
+                      : sqlite3_bind_text(stmt, 2, note, -1, SQLITE_STATIC);
+    if (handle_rc(rc, db)) defer(res, 1);
+    rc = sqlite3_bind_int64(stmt, 3, (sqlite3_int64)period * SECONDS_PER_DAY);
+    if (handle_rc(rc, db)) defer(res, 1);
+    rc = sqlite3_bind_int64(stmt, 4, time(NULL));
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/* Push a task for every due schedule in the `db` and move schedules to their
+ * next due time. Schedules missed several times push only one task. Must run
+ * in a transaction. Returns non-zero value on error, zero otherwise. */
+static int push_due(sqlite3* db) {
+    int res = 0;
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_stmt* task_stmt = NULL;
+    sqlite3_stmt* note_stmt = NULL;
+
+    // RETURNING rows are produced before the first step returns, so inserting
+    // tasks in the loop doesn't interfere with the update
+    const char* sql =
+        "UPDATE schedules"
+        " SET next_due=next_due+period*((?1-next_due)/period+1)"
+        " WHERE next_due<=?1 RETURNING name, note;";
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+    rc = sqlite3_bind_int64(stmt, 1, time(NULL));
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    sql = "INSERT INTO tasks (name) VALUES (?1);";
+    rc = sqlite3_prepare_v2(db, sql, -1, &task_stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+    sql = "INSERT INTO task_notes (task_id, note) VALUES (?1, ?2);";
+    rc = sqlite3_prepare_v2(db, sql, -1, &note_stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        rc = sqlite3_bind_value(task_stmt, 1, sqlite3_column_value(stmt, 0));
+        if (handle_rc(rc, db)) defer(res, 1);
+        rc = sqlite3_step(task_stmt);
+        sqlite3_reset(task_stmt);
+        if (rc != SQLITE_DONE) {
+            error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+            defer(res, 1);
+        }
+        if (sqlite3_column_type(stmt, 1) == SQLITE_NULL) continue;
+
+        rc = sqlite3_bind_int64(note_stmt, 1, sqlite3_last_insert_rowid(db));
+        if (handle_rc(rc, db)) defer(res, 1);
+        rc = sqlite3_bind_value(note_stmt, 2, sqlite3_column_value(stmt, 1));
+        if (handle_rc(rc, db)) defer(res, 1);
+        rc = sqlite3_step(note_stmt);
+        sqlite3_reset(note_stmt);
+        if (rc != SQLITE_DONE) {
+            error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+            defer(res, 1);
+        }
+    }
+    if (rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+defer:
+    sqlite3_finalize(stmt);
+    sqlite3_finalize(task_stmt);
+    sqlite3_finalize(note_stmt);
+    return res;
+}
+
+/* Create a schedule in the `db`, which pushes task with name `name` and note
+ * `note` every `days` days, and push its first task. Both happen in a single
+ * transaction. `days` is a numeric string. If `note` is NULL, tasks get no
+ * note. Returns non-zero value on error, zero otherwise. */
+int push_schedule(sqlite3* db, const char* name, const char* note,
+                  const char* days) {
+    int res = 0;
+    if (name == NULL) return 1;
+    int period = parse_days(days);
+    if (period < 0) return 1;
+
+    char* errmsg = NULL;
+    int rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, &errmsg);
+    if (handle_exec_rc(rc, errmsg)) return 1;
+    // first occurrence is due right away
+    if (insert_schedule(db, name, note, period)) defer(res, 1);
+    if (push_due(db)) defer(res, 1);
+defer:
+    rc = sqlite3_exec(db, res == 0 ? "COMMIT;" : "ROLLBACK;", NULL, NULL,
+                      &errmsg);
+    if (handle_exec_rc(rc, errmsg)) res = 1;
+    return res;
+}
+
+/* Fetch and print id, name, period and next due date for all schedules in the
+ * `db`. Returns non-zero error code if an error occurs, zero otherwise. */
+int list_schedules(sqlite3* db) {
+    int res = 0;
+    sqlite3_stmt* stmt;
+    const char* sql =
+        "SELECT id, name, period/86400,"
+        " date(next_due, 'unixepoch', 'localtime') FROM schedules;";
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const unsigned char* id = sqlite3_column_text(stmt, 0);
+        if (sqlite3_errcode(db) == SQLITE_NOMEM) defer(res, 1);
+        const unsigned char* name = sqlite3_column_text(stmt, 1);
+        if (sqlite3_errcode(db) == SQLITE_NOMEM) defer(res, 1);
+        const unsigned char* days = sqlite3_column_text(stmt, 2);
+        if (sqlite3_errcode(db) == SQLITE_NOMEM) defer(res, 1);
+        const unsigned char* due = sqlite3_column_text(stmt, 3);
+        if (sqlite3_errcode(db) == SQLITE_NOMEM) defer(res, 1);
+        printf("{%s} %s (every %s days, next on %s)\n", id, name, days, due);
+    }
+
+    if (rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/* Delete a schedule from the `db` obtained by numeric string `id`. Tasks it
+ * already pushed are kept. Returns non-zero value on error, zero otherwise. */
+int drop_schedule(sqlite3* db, const char* id) {
+    int res = 0;
+    if (!mbstr_isnumeric(id)) return 1;
+
+    sqlite3_stmt* stmt;
+    char* sql = "DELETE FROM schedules WHERE id=?1;";
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    rc = sqlite3_bind_text(stmt, 1, id, -1, SQLITE_STATIC);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+    if (sqlite3_changes(db) == 0) {
+        error("No recurring task with id '%s'\n", id);
+        defer(res, 1);
+    }
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/* Check whether any schedule in the `db` is due. The check is a single lookup
+ * in `schedules_due` index. Writes result to `due`. Returns non-zero value on
+ * error, zero otherwise. */
+int schedules_due(sqlite3* db, bool* due) {
+    int res = 0;
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT 1 FROM schedules WHERE next_due<=?1 LIMIT 1;";
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    rc = sqlite3_bind_int64(stmt, 1, time(NULL));
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    rc = sqlite3_step(stmt);
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+    *due = rc == SQLITE_ROW;
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/* Push tasks of due schedules in the `db` in a single transaction, see
+ * `push_due`. Returns non-zero value on error, zero otherwise. */
+int materialize_schedules(sqlite3* db) {
+    int res = 0;
+    bool due = false;
+    if (schedules_due(db, &due)) return 1;
+    if (!due) return 0;
+
+    char* errmsg = NULL;
+    int rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, &errmsg);
+    if (handle_exec_rc(rc, errmsg)) return 1;
+    res = push_due(db);
+    rc = sqlite3_exec(db, res == 0 ? "COMMIT;" : "ROLLBACK;", NULL, NULL,
+                      &errmsg);
+    if (handle_exec_rc(rc, errmsg)) res = 1;
+    return res;
+}
@@ -0,0 +1,398 @@
+#include "sync.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "db.h"
+#include "defs.h"
+#include "sqlite3.h"
+
+// Size of replica ids and task uids, see `randomblob(16)` in db.c
+#define UID_LEN 16
+
+// Statements used to apply a change to one side, see `apply_sql`
+enum {
+    FindRev = 0,
+    NextSeq,
+    DropTask,
+    PutTomb,
+    DropTomb,
+    PutTask,
+    DropNote,
+    PutNote,
+    ApplyStmtCount,
+};
+
+/* Templates of statements applying a change to schema `%w`. Change is bound as
+ * ?1 uid, ?2 name, ?3 note, ?4 rev, ?5 origin, ?6 created, ?7 seq. */
+static const char* apply_sql[ApplyStmtCount] = {
+    [FindRev] =
+        "SELECT rev, origin FROM %w.tasks WHERE uid=?1"
+        " UNION ALL SELECT rev, origin FROM %w.tombstones WHERE uid=?1;",
+    [NextSeq] =
+        "UPDATE %w.sync_meta SET value=value+1 WHERE key='seq'"
+        " RETURNING value;",
+    [DropTask] = "DELETE FROM %w.tasks WHERE uid=?1;",
+    [PutTomb] =
+        "INSERT INTO %w.tombstones (uid, rev, origin, seq, created)"
+        " VALUES (?1, ?4, ?5, ?7, ?6) ON CONFLICT (uid) DO UPDATE SET"
+        " rev=excluded.rev, origin=excluded.origin, seq=excluded.seq,"
+        " created=excluded.created;",
+    [DropTomb] = "DELETE FROM %w.tombstones WHERE uid=?1;",
+    [PutTask] =
+        "INSERT INTO %w.tasks (uid, name, rev, origin, seq, created)"
+        " VALUES (?1, ?2, ?4, ?5, ?7, ?6) ON CONFLICT (uid) DO UPDATE SET"
+        " name=excluded.name, rev=excluded.rev, origin=excluded.origin,"
+        " seq=excluded.seq, created=excluded.created;",
+    [DropNote] =
+        "DELETE FROM %w.task_notes"
+        " WHERE task_id=(SELECT id FROM %w.tasks WHERE uid=?1);",
+    [PutNote] =
+        "INSERT OR REPLACE INTO %w.task_notes (task_id, note)"
+        " SELECT id, ?3 FROM %w.tasks WHERE uid=?1;",
+};
+
+/* Changes of schema `%w` made after seq ?1: live tasks first, then tombstones.
+ * Both parts are driven by seq indexes. */
+static const char* changes_sql =
+    "SELECT t.uid, t.name, n.note, t.rev, t.origin, t.created, 0"
+    " FROM %w.tasks t LEFT JOIN %w.task_notes n ON n.task_id=t.id"
+    " WHERE t.seq>?1 UNION ALL SELECT uid, NULL, NULL, rev, origin,"
+    " created, 1 FROM %w.tombstones WHERE seq>?1;";
+
+/* Prepare statement from template `tmpl` for schema `schema`. Returns non-zero
+ * value on error, and zero otherwise. */
+static int prepare_for(sqlite3* db, const char* tmpl, const char* schema,
+                       sqlite3_stmt** stmt) {
+    char* sql = sqlite3_mprintf(tmpl, schema, schema, schema);
+    if (sql == NULL) {
+        error("Out of memory\n");
+        return 1;
+    }
+    int rc = sqlite3_prepare_v2(db, sql, -1, stmt, NULL);
+    sqlite3_free(sql);
+    return handle_rc(rc, db);
+}
+
+/* Execute `sql` formatted with `schema`. Returns non-zero value on error, and
+ * zero otherwise. */
+static int exec_for(sqlite3* db, const char* tmpl, const char* schema) {
+    sqlite3_stmt* stmt = NULL;
+    if (prepare_for(db, tmpl, schema, &stmt)) return 1;
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        return 1;
+    }
+    return 0;
+}
+
+/* Read replica id of `schema` into `replica`. Returns non-zero value on error,
+ * and zero otherwise. */
+static int read_replica(sqlite3* db, const char* schema,
+                        unsigned char replica[UID_LEN]) {
+    int res = 0;
+    sqlite3_stmt* stmt = NULL;
+    if (prepare_for(db,
+                    "SELECT value FROM %w.sync_meta WHERE key='replica';",
+                    schema, &stmt))
+        defer(res, 1);
+    if (sqlite3_step(stmt) != SQLITE_ROW ||
+        sqlite3_column_bytes(stmt, 0) != UID_LEN) {
+        error("Database '%s' has no valid replica id\n", schema);
+        defer(res, 1);
+    }
+    memcpy(replica, sqlite3_column_blob(stmt, 0), UID_LEN);
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/* Read seq of the last change of `schema` into `seq`. Returns non-zero value
+ * on error, and zero otherwise. */
+static int read_seq(sqlite3* db, const char* schema, sqlite3_int64* seq) {
+    int res = 0;
+    sqlite3_stmt* stmt = NULL;
+    if (prepare_for(db, "SELECT value FROM %w.sync_meta WHERE key='seq';",
+                    schema, &stmt))
+        defer(res, 1);
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+    *seq = sqlite3_column_int64(stmt, 0);
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/* Read seq of the last change of `peer` already received by `schema` into
+ * `seq`. It's zero if they were never synced. Returns non-zero value on error,
+ * and zero otherwise. */
+static int read_recv_seq(sqlite3* db, const char* schema,
+                         const unsigned char peer[UID_LEN],
+                         sqlite3_int64* seq) {
+    int res = 0;
+    sqlite3_stmt* stmt = NULL;
+    if (prepare_for(db,
+                    "SELECT recv_seq FROM %w.sync_peers WHERE replica=?1;",
+                    schema, &stmt))
+        defer(res, 1);
+    int rc = sqlite3_bind_blob(stmt, 1, peer, UID_LEN, SQLITE_STATIC);
+    if (handle_rc(rc, db)) defer(res, 1);
+    rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
+        *seq = sqlite3_column_int64(stmt, 0);
+    else if (rc == SQLITE_DONE)
+        *seq = 0;
+    else {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/* Remember that `schema` received all changes of `peer` up to `seq`. Returns
+ * non-zero value on error, and zero otherwise. */
+static int write_recv_seq(sqlite3* db, const char* schema,
+                          const unsigned char peer[UID_LEN],
+                          sqlite3_int64 seq) {
+    int res = 0;
+    sqlite3_stmt* stmt = NULL;
+    if (prepare_for(db,
+                    "INSERT OR REPLACE INTO %w.sync_peers (replica, recv_seq)"
+                    " VALUES (?1, ?2);",
+                    schema, &stmt))
+        defer(res, 1);
+    int rc = sqlite3_bind_blob(stmt, 1, peer, UID_LEN, SQLITE_STATIC);
+    if (handle_rc(rc, db)) defer(res, 1);
+    rc = sqlite3_bind_int64(stmt, 2, seq);
+    if (handle_rc(rc, db)) defer(res, 1);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/* Compare revisions (`rev_a`, `origin_a`) and (`rev_b`, `origin_b`). Higher
+ * rev wins, ties are broken by origin replica id, so both sides pick the same
+ * winner. Returns negative, zero or positive value like `memcmp`. */
+static int compare_rev(sqlite3_int64 rev_a, const void* origin_a, int len_a,
+                       sqlite3_int64 rev_b, const void* origin_b, int len_b) {
+    if (rev_a != rev_b) return rev_a < rev_b ? -1 : 1;
+    int n = len_a < len_b ? len_a : len_b;
+    int cmp = n > 0 ? memcmp(origin_a, origin_b, n) : 0;
+    if (cmp != 0) return cmp;
+    return len_a - len_b;
+}
+
+/* Apply a single change, which is the current row of `change` (see
+ * `changes_sql`), using statements `stmts` prepared for target schema. Sets
+ * `applied` to true if the change won over the target's revision. Returns
+ * non-zero value on error, and zero otherwise. */
+static int apply_change(sqlite3* db, sqlite3_stmt** stmts,
+                        sqlite3_stmt* change, bool* applied) {
+    int res = 0;
+    int rc = 0;
+    *applied = false;
+
+    sqlite3_int64 rev = sqlite3_column_int64(change, 3);
+    const void* origin = sqlite3_column_blob(change, 4);
+    int origin_len = sqlite3_column_bytes(change, 4);
+    bool dead = sqlite3_column_int(change, 6) != 0;
+
+    sqlite3_stmt* find = stmts[FindRev];
+    rc = sqlite3_bind_value(find, 1, sqlite3_column_value(change, 0));
+    if (handle_rc(rc, db)) defer(res, 1);
+    rc = sqlite3_step(find);
+    if (rc == SQLITE_ROW) {
+        if (compare_rev(rev, origin, origin_len, sqlite3_column_int64(find, 0),
+                        sqlite3_column_blob(find, 1),
+                        sqlite3_column_bytes(find, 1)) <= 0)
+            defer(res, 0);  // target already has this or newer revision
+    } else if (rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+
+    sqlite3_stmt* next_seq = stmts[NextSeq];
+    if (sqlite3_step(next_seq) != SQLITE_ROW) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+    sqlite3_int64 seq = sqlite3_column_int64(next_seq, 0);
+
+    int steps[3];
+    int nsteps = 0;
+    if (dead) {
+        steps[nsteps++] = DropTask;
+        steps[nsteps++] = PutTomb;
+    } else {
+        steps[nsteps++] = DropTomb;
+        steps[nsteps++] = PutTask;
+        steps[nsteps++] =
+            sqlite3_column_type(change, 2) == SQLITE_NULL ? DropNote : PutNote;
+    }
+    for (int i = 0; i < nsteps; ++i) {
+        sqlite3_stmt* stmt = stmts[steps[i]];
+        // parameters ?1-?6 are columns of `change`, ?7 is the new seq
+        int count = sqlite3_bind_parameter_count(stmt);
+        for (int p = 1; p <= count && p <= 6; ++p) {
+            rc = sqlite3_bind_value(stmt, p,
+                                    sqlite3_column_value(change, p - 1));
+            if (handle_rc(rc, db)) defer(res, 1);
+        }
+        if (count >= 7) {
+            rc = sqlite3_bind_int64(stmt, 7, seq);
+            if (handle_rc(rc, db)) defer(res, 1);
+        }
+        rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (rc != SQLITE_DONE) {
+            error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+            defer(res, 1);
+        }
+    }
+    *applied = true;
+defer:
+    sqlite3_reset(find);
+    sqlite3_reset(stmts[NextSeq]);
+    return res;
+}
+
+/* Apply changes of schema `from` made after `since` to schema `to`. Number of
+ * changes that won is written to `count`. Returns non-zero value on error, and
+ * zero otherwise. */
+static int pull_changes(sqlite3* db, const char* from, const char* to,
+                        sqlite3_int64 since, int* count) {
+    int res = 0;
+    int rc = 0;
+    sqlite3_stmt* changes = NULL;
+    sqlite3_stmt* stmts[ApplyStmtCount] = {0};
+    *count = 0;
+
+    for (int i = 0; i < ApplyStmtCount; ++i) {
+        if (prepare_for(db, apply_sql[i], to, &stmts[i])) defer(res, 1);
+    }
+    if (prepare_for(db, changes_sql, from, &changes)) defer(res, 1);
+    rc = sqlite3_bind_int64(changes, 1, since);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    while ((rc = sqlite3_step(changes)) == SQLITE_ROW) {
+        bool applied = false;
+        if (apply_change(db, stmts, changes, &applied)) defer(res, 1);
+        if (applied) ++*count;
+    }
+    if (rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+defer:
+    sqlite3_finalize(changes);
+    for (int i = 0; i < ApplyStmtCount; ++i) sqlite3_finalize(stmts[i]);
+    return res;
+}
+
+/* Exchange changes between `db` and database located at `peer_name` made since
+ * their last sync. Conflicting changes are resolved by `compare_rev`. Both
+ * databases are changed in a single transaction. Returns non-zero value on
+ * error, and zero otherwise. */
+int sync_db(sqlite3* db, const char* peer_name) {
+    int res = 0;
+    int rc = 0;
+    char* errmsg = NULL;
+    sqlite3* peer = NULL;
+    bool attached = false;
+    bool in_tx = false;
+
+    // bring peer's schema up to date before attaching it, attaching a missing
+    // file would create an empty database and copy everything into it
+    rc = db_init_existing(&peer, peer_name);
+    sqlite3_close(peer);
+    if (rc != 0) defer(res, 1);
+
+    sqlite3_stmt* attach = NULL;
+    rc = sqlite3_prepare_v2(db, "ATTACH DATABASE ?1 AS peer;", -1, &attach,
+                            NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+    sqlite3_bind_text(attach, 1, peer_name, -1, SQLITE_STATIC);
+    rc = sqlite3_step(attach);
+    sqlite3_finalize(attach);
+    if (rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+    attached = true;
+
+    // replica ids are changed only by --new-replica, a separate command that
+    // never runs during a sync, so they can be checked before taking locks on
+    // both sides
+    unsigned char local_id[UID_LEN];
+    unsigned char peer_id[UID_LEN];
+    if (read_replica(db, "main", local_id)) defer(res, 1);
+    if (read_replica(db, "peer", peer_id)) defer(res, 1);
+    if (memcmp(local_id, peer_id, UID_LEN) == 0) {
+        error("Can't sync database with itself or its copy, run 'td "
+              "--new-replica' for the copy first\n");
+        defer(res, 1);
+    }
+
+    rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, &errmsg);
+    if (handle_exec_rc(rc, errmsg)) defer(res, 1);
+    in_tx = true;
+
+    sqlite3_int64 local_since = 0;
+    sqlite3_int64 peer_since = 0;
+    if (read_recv_seq(db, "main", peer_id, &local_since)) defer(res, 1);
+    if (read_recv_seq(db, "peer", local_id, &peer_since)) defer(res, 1);
+
+    const char* guard = "UPDATE %w.sync_meta SET value=1 WHERE key='applying';";
+    if (exec_for(db, guard, "main") || exec_for(db, guard, "peer"))
+        defer(res, 1);
+
+    int received = 0;
+    int sent = 0;
+    if (pull_changes(db, "peer", "main", local_since, &received)) defer(res, 1);
+    // changes just received come back here too, but they lose as equal
+    if (pull_changes(db, "main", "peer", peer_since, &sent)) defer(res, 1);
+
+    guard = "UPDATE %w.sync_meta SET value=0 WHERE key='applying';";
+    if (exec_for(db, guard, "main") || exec_for(db, guard, "peer"))
+        defer(res, 1);
+
+    // each side now has everything the other one has
+    sqlite3_int64 local_seq = 0;
+    sqlite3_int64 peer_seq = 0;
+    if (read_seq(db, "main", &local_seq)) defer(res, 1);
+    if (read_seq(db, "peer", &peer_seq)) defer(res, 1);
+    if (write_recv_seq(db, "main", peer_id, peer_seq)) defer(res, 1);
+    if (write_recv_seq(db, "peer", local_id, local_seq)) defer(res, 1);
+
+    rc = sqlite3_exec(db, "COMMIT;", NULL, NULL, &errmsg);
+    if (handle_exec_rc(rc, errmsg)) defer(res, 1);
+    in_tx = false;
+    printf("Synced with '%s': %d received, %d sent\n", peer_name, received,
+           sent);
+defer:
+    if (in_tx) sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+    if (attached) sqlite3_exec(db, "DETACH DATABASE peer;", NULL, NULL, NULL);
+    return res;
+}
+
+/* Give `db` a new random replica id, so a copy of a database can be synced
+ * with the original. Peers see it as a new replica. Returns non-zero value on
+ * error, and zero otherwise. */
+int new_replica(sqlite3* db) {
+    char* errmsg = NULL;
+    int rc = sqlite3_exec(db,
+                          "UPDATE sync_meta SET value=randomblob(16)"
+                          " WHERE key='replica';",
+                          NULL, NULL, &errmsg);
+    return handle_exec_rc(rc, errmsg);
+}
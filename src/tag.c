@@ -0,0 +1,254 @@
+#include "tag.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "db.h"
+#include "defs.h"
+#include "sqlite3.h"
+#include "str.h"
+
+// Max number of tags in one command
+#define TAGS_MAX 16
+
+/* Split string `s` by `sep` in place and store at most `TAGS_MAX` tags in
+ * `tags`. Returns number of tags, or -1 if any tag is empty, contains a tag
+ * separator or there are too many of them. */
+static int split_tags(char* s, char sep, char** tags) {
+    int n = 0;
+    while (s != NULL) {
+        if (n == TAGS_MAX) {
+            error("Too many tags, at most %d are allowed\n", TAGS_MAX);
+            return -1;
+        }
+        char* next = strchr(s, sep);
+        if (next != NULL) *next++ = '\0';
+        if (mbstr_isempty(s) || strpbrk(s, TAG_SEP_ALL TAG_SEP_ANY) != NULL) {
+            error("Invalid tag '%s'\n", s);
+            return -1;
+        }
+        tags[n++] = s;
+        s = next;
+    }
+    return n;
+}
+
+/* Check whether a task with numeric string `id` exists in the `db`. Writes
+ * result to `exists`. Returns non-zero value on error, zero otherwise. */
+static int task_exists(sqlite3* db, const char* id, bool* exists) {
+    int res = 0;
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT 1 FROM tasks WHERE id=?1;";
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    rc = sqlite3_bind_text(stmt, 1, id, -1, SQLITE_STATIC);
+    if (handle_rc(rc, db)) defer(res, 1);
+
+    rc = sqlite3_step(stmt);
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+    *exists = rc == SQLITE_ROW;
+defer:
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+/* Run each statement of `sqls` (terminated by NULL) once for every tag of
+ * `tags`, binding the tag as ?1 and numeric string `id` as ?2 if statement
+ * has it, in a single transaction. Returns non-zero value on error, zero
+ * otherwise. */
+static int for_each_tag(sqlite3* db, const char* id, char** tags, int n,
+                        const char** sqls) {
+    int res = 0;
+    char* errmsg = NULL;
+    sqlite3_stmt* stmt = NULL;
+    int rc = sqlite3_exec(db, "BEGIN;", NULL, NULL, &errmsg);
+    if (handle_exec_rc(rc, errmsg)) return 1;
+
+    for (; *sqls != NULL; ++sqls) {
+        rc = sqlite3_prepare_v2(db, *sqls, -1, &stmt, NULL);
+        if (handle_rc(rc, db)) defer(res, 1);
+        for (int i = 0; i < n; ++i) {
+            rc = sqlite3_bind_text(stmt, 1, tags[i], -1, SQLITE_STATIC);
+            if (handle_rc(rc, db)) defer(res, 1);
+            if (sqlite3_bind_parameter_count(stmt) >= 2) {
+                rc = sqlite3_bind_text(stmt, 2, id, -1, SQLITE_STATIC);
+                if (handle_rc(rc, db)) defer(res, 1);
+            }
+            rc = sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+            if (rc != SQLITE_DONE) {
+                error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+                defer(res, 1);
+            }
+        }
+        sqlite3_finalize(stmt);
+        stmt = NULL;
+    }
+defer:
+    sqlite3_finalize(stmt);
+    rc = sqlite3_exec(db, res == 0 ? "COMMIT;" : "ROLLBACK;", NULL, NULL,
+                      &errmsg);
+    if (handle_exec_rc(rc, errmsg)) res = 1;
+    return res;
+}
+
+/* Add tags from comma-separated string `tags` to a task obtained by numeric
+ * string `id`. Tags are created as needed. `tags` is modified. Returns non-zero
+ * value on error, zero otherwise. */
+int tag_task(sqlite3* db, const char* id, char* tags) {
+    if (!mbstr_isnumeric(id)) return 1;
+    char* names[TAGS_MAX];
+    int n = split_tags(tags, TAG_SEP_ALL[0], names);
+    if (n < 0) return 1;
+
+    bool exists = false;
+    if (task_exists(db, id, &exists)) return 1;
+    if (!exists) {
+        error("No task with id '%s'\n", id);
+        return 1;
+    }
+
+    const char* sqls[] = {
+        "INSERT OR IGNORE INTO tags (name) VALUES (?1);",
+        "INSERT OR IGNORE INTO task_tags (tag_id, task_id)"
+        " SELECT id, ?2 FROM tags WHERE name=?1;",
+        NULL,
+    };
+    return for_each_tag(db, id, names, n, sqls);
+}
+
+/* Remove tags from comma-separated string `tags` from a task obtained by
+ * numeric string `id`. `tags` is modified. Returns non-zero value on error,
+ * zero otherwise. */
+int untag_task(sqlite3* db, const char* id, char* tags) {
+    if (!mbstr_isnumeric(id)) return 1;
+    char* names[TAGS_MAX];
+    int n = split_tags(tags, TAG_SEP_ALL[0], names);
+    if (n < 0) return 1;
+
+    bool exists = false;
+    if (task_exists(db, id, &exists)) return 1;
+    if (!exists) {
+        error("No task with id '%s'\n", id);
+        return 1;
+    }
+
+    const char* sqls[] = {
+        "DELETE FROM task_tags WHERE task_id=?2"
+        " AND tag_id=(SELECT id FROM tags WHERE name=?1);",
+        NULL,
+    };
+    return for_each_tag(db, id, names, n, sqls);
+}
+
+/* Fetch and print id and name for tasks in the `db` matching `filter`. Tags in
+ * `filter` separated by `TAG_SEP_ALL` must all be set on a task, tags
+ * separated by `TAG_SEP_ANY` - any of them. `filter` is modified. Returns
+ * non-zero error code if an error occurs, zero otherwise. */
+int filter_tasks(sqlite3* db, char* filter) {
+    int res = 0;
+    int rc = 0;
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_str* sql = NULL;
+    char* sql_text = NULL;
+
+    bool any = strpbrk(filter, TAG_SEP_ANY) != NULL;
+    if (any && strpbrk(filter, TAG_SEP_ALL) != NULL) {
+        error("Can't mix '" TAG_SEP_ALL "' and '" TAG_SEP_ANY "' in filter\n");
+        return 1;
+    }
+    char* names[TAGS_MAX];
+    int n = split_tags(filter, any ? TAG_SEP_ANY[0] : TAG_SEP_ALL[0], names);
+    if (n < 0) return 1;
+
+    // resolve tag ids, unknown tags match no tasks
+    sqlite3_int64 ids[TAGS_MAX];
+    sqlite3_int64 counts[TAGS_MAX];
+    int found = 0;
+    rc = sqlite3_prepare_v2(db, "SELECT id, count FROM tags WHERE name=?1;",
+                            -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+    for (int i = 0; i < n; ++i) {
+        rc = sqlite3_bind_text(stmt, 1, names[i], -1, SQLITE_STATIC);
+        if (handle_rc(rc, db)) defer(res, 1);
+        rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) {
+            ids[found] = sqlite3_column_int64(stmt, 0);
+            counts[found++] = sqlite3_column_int64(stmt, 1);
+        } else if (rc != SQLITE_DONE) {
+            error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+            defer(res, 1);
+        } else if (!any) {
+            defer(res, 0);
+        }
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+    if (found == 0) defer(res, 0);
+
+    sql = sqlite3_str_new(db);
+    if (any) {
+        sqlite3_str_appendall(sql,
+                              "SELECT id, name FROM tasks WHERE id IN"
+                              " (SELECT task_id FROM task_tags"
+                              " WHERE tag_id IN (?1");
+        for (int i = 2; i <= found; ++i) sqlite3_str_appendf(sql, ",?%d", i);
+        sqlite3_str_appendall(sql, "));");
+    } else {
+        // walk the rarest tag's tasks and probe the rest by primary key
+        for (int i = 1; i < found; ++i) {
+            for (int j = i; j > 0 && counts[j] < counts[j - 1]; --j) {
+                sqlite3_int64 t = counts[j];
+                counts[j] = counts[j - 1];
+                counts[j - 1] = t;
+                t = ids[j];
+                ids[j] = ids[j - 1];
+                ids[j - 1] = t;
+            }
+        }
+        sqlite3_str_appendall(sql,
+                              "SELECT t.id, t.name FROM task_tags p"
+                              " CROSS JOIN tasks t ON t.id=p.task_id"
+                              " WHERE p.tag_id=?1");
+        for (int i = 2; i <= found; ++i) {
+            sqlite3_str_appendf(sql,
+                                " AND EXISTS (SELECT 1 FROM task_tags"
+                                " WHERE tag_id=?%d AND task_id=p.task_id)",
+                                i);
+        }
+        sqlite3_str_appendall(sql, ";");
+    }
+    sql_text = sqlite3_str_finish(sql);
+    if (sql_text == NULL) {
+        error("Out of memory\n");
+        defer(res, 1);
+    }
+
+    rc = sqlite3_prepare_v2(db, sql_text, -1, &stmt, NULL);
+    if (handle_rc(rc, db)) defer(res, 1);
+    for (int i = 0; i < found; ++i) {
+        rc = sqlite3_bind_int64(stmt, i + 1, ids[i]);
+        if (handle_rc(rc, db)) defer(res, 1);
+    }
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const unsigned char* id = sqlite3_column_text(stmt, 0);
+        if (sqlite3_errcode(db) == SQLITE_NOMEM) defer(res, 1);
+        const unsigned char* name = sqlite3_column_text(stmt, 1);
+        if (sqlite3_errcode(db) == SQLITE_NOMEM) defer(res, 1);
+        printf("{%s} %s\n", id, name);
+    }
+    if (rc != SQLITE_DONE) {
+        error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+        defer(res, 1);
+    }
+defer:
+    sqlite3_finalize(stmt);
+    sqlite3_free(sql_text);
+    return res;
+}
@@ -44,7 +44,9 @@ int info_task(sqlite3* db, const char* id) {
     if (!mbstr_isnumeric(id)) return 1;
 
     sqlite3_stmt* stmt;
-    const char* sql = "SELECT id, name, note FROM tasks WHERE id=?1;";
+    const char* sql =
+        "SELECT id, name, note FROM tasks"
+        " LEFT JOIN task_notes ON task_id=id WHERE id=?1;";
     int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
     if (handle_rc(rc, db)) defer(res, 1);
 
@@ -70,30 +72,51 @@ defer:
 }
 
 /* Push new task to the `db` with name `name` and note `note`. If `note` is
- * NULL, tasks's note is SQL NULL. Returns non-zero value on error, zero
- * otherwise. */
+ * NULL, task gets no note. Returns non-zero value on error, zero otherwise. */
 int push_task(sqlite3* db, const char* name, const char* note) {
     int res = 0;
     if (name == NULL) return 1;
 
-    sqlite3_stmt* stmt;
-    char* sql = "INSERT INTO tasks (name, note) VALUES (?1, ?2);";
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    sqlite3_stmt* stmt = NULL;
+    char* errmsg = NULL;
+    int rc = sqlite3_exec(db, "BEGIN;", NULL, NULL, &errmsg);
+    if (handle_exec_rc(rc, errmsg)) return 1;
+
+    char* sql = "INSERT INTO tasks (name) VALUES (?1);";
+    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
     if (handle_rc(rc, db)) defer(res, 1);
 
     rc = sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
     if (handle_rc(rc, db)) defer(res, 1);
-    rc = note == NULL ? sqlite3_bind_null(stmt, 2)
-                      : sqlite3_bind_text(stmt, 2, note, -1, SQLITE_STATIC);
-    if (handle_rc(rc, db)) defer(res, 1);
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE) {
         error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
         defer(res, 1);
     }
+
+    if (note != NULL) {
+        sqlite3_finalize(stmt);
+        sql = "INSERT INTO task_notes (task_id, note) VALUES (?1, ?2);";
+        rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+        if (handle_rc(rc, db)) defer(res, 1);
+
+        rc = sqlite3_bind_int64(stmt, 1, sqlite3_last_insert_rowid(db));
+        if (handle_rc(rc, db)) defer(res, 1);
+        rc = sqlite3_bind_text(stmt, 2, note, -1, SQLITE_STATIC);
+        if (handle_rc(rc, db)) defer(res, 1);
+
+        rc = sqlite3_step(stmt);
+        if (rc != SQLITE_DONE) {
+            error("Sqlite3 error: %s\n", sqlite3_errmsg(db));
+            defer(res, 1);
+        }
+    }
 defer:
     sqlite3_finalize(stmt);
+    rc = sqlite3_exec(db, res == 0 ? "COMMIT;" : "ROLLBACK;", NULL, NULL,
+                      &errmsg);
+    if (handle_exec_rc(rc, errmsg)) res = 1;
     return res;
 }
 
@@ -136,7 +159,9 @@ int amend_task(sqlite3* db, int mode, const char* id, const char* s) {
             sql = "UPDATE tasks SET name=?1 WHERE id=?2;";
             break;
         case AMEND_NOTE:
-            sql = "UPDATE tasks SET note=?1 WHERE id=?2;";
+            sql =
+                "INSERT OR REPLACE INTO task_notes (task_id, note)"
+                " SELECT id, ?1 FROM tasks WHERE id=?2;";
             break;
         default:
             return 1;
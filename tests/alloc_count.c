@@ -0,0 +1,35 @@
+/* Preloaded by memrun to count heap allocations of a process. The count is
+ * written to the file named by TD_ALLOC_LOG when the process exits. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static unsigned long allocs = 0;
+
+void* malloc(size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+__attribute__((destructor)) static void report_allocs(void) {
+    const char* path = getenv("TD_ALLOC_LOG");
+    if (path == NULL) return;
+    FILE* f = fopen(path, "w");
+    if (f == NULL) return;
+    fprintf(f, "%lu\n", __atomic_load_n(&allocs, __ATOMIC_RELAXED));
+    fclose(f);
+}
@@ -0,0 +1,82 @@
+# Helpers shared by test and benchmark scripts. Source it with `TD` set to the
+# binary under test, defaults to ./td.
+
+TD=$(realpath "${TD:-./td}")
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# Compare `actual` with `expected`, failing with `what` if they differ
+expect_eq() {
+    [ "$1" == "$2" ] || fail "$3: expected '$2', got '$1'"
+}
+
+# Create a scratch directory, removed on exit, with its own HOME and td
+# database. Sets WORK and DB.
+setup_work() {
+    WORK=$(mktemp -d "${TMPDIR:-/tmp}/td.XXXXXX")
+    trap 'rm -rf "$WORK"' EXIT
+    export HOME="$WORK/home"
+    mkdir -p "$HOME/.td"
+    DB="$HOME/.td/td_data.db"
+    # td sets en_US.utf8, borrow C.utf8 where it isn't installed
+    if ! locale -a 2>/dev/null | grep -qix 'en_US.utf-\?8'; then
+        for c in /usr/lib/locale/C.utf8 /usr/lib/locale/C.UTF-8; do
+            [ -d "$c" ] || continue
+            export LOCPATH="$WORK/locale"
+            mkdir -p "$LOCPATH"
+            cp -r "$c" "$LOCPATH/en_US.utf8"
+            break
+        done
+    fi
+}
+
+# Current time in milliseconds
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+# Run command `RUNS` times (default 10) with output discarded and print
+# average milliseconds per run
+time_runs() {
+    local runs=${RUNS:-10}
+    local start=$(now_ms)
+    for ((i = 0; i < runs; ++i)); do "$@" >/dev/null; done
+    awk -v t=$(($(now_ms) - start)) -v n=$runs 'BEGIN { printf "%.2f\n", t / n }'
+}
+
+# SQL selecting column `i` from 1 to $1
+series() {
+    echo "WITH RECURSIVE n (i) AS" \
+        "(SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i<$1) SELECT i FROM n"
+}
+
+# Insert $1 tasks into DB, which td creates if it's missing. $2 and $3 are SQL
+# expressions of task number `i` giving name and note, NULL note means none.
+# With the original schema notes go to the `note` column of tasks.
+seed_tasks() {
+    local count=$1 name=${2:-"'task ' || i"} note=${3:-NULL}
+    [ -f "$DB" ] || (cd "$(dirname "$(dirname "$DB")")" && "$TD" >/dev/null)
+    if [ -n "$(sqlite3 "$DB" \
+        "SELECT 1 FROM pragma_table_info('tasks') WHERE name='note';")" ]; then
+        sqlite3 "$DB" "INSERT INTO tasks (name, note)
+            SELECT $name, $note FROM ($(series "$count"));"
+        return
+    fi
+    sqlite3 "$DB" "CREATE TEMP TABLE seed AS
+            SELECT i, $name AS name, $note AS note FROM ($(series "$count"));
+        INSERT INTO tasks (name) SELECT name FROM seed ORDER BY i;
+        INSERT INTO task_notes (task_id, note)
+            SELECT (SELECT max(id) FROM tasks) - $count + i, note FROM seed
+            WHERE note IS NOT NULL;"
+}
+
+# Tag tasks of DB matching SQL condition $2 with tag $1
+seed_tag() {
+    sqlite3 "$DB" "INSERT OR IGNORE INTO tags (name) VALUES ('$1');
+        INSERT INTO task_tags (tag_id, task_id)
+            SELECT (SELECT id FROM tags WHERE name='$1'), id FROM tasks
+            WHERE $2;"
+}
@@ -0,0 +1,102 @@
+#!/bin/bash
+# Growth of peak RSS and heap allocation count of every command from a database
+# of 2000 UTF-8 tasks to one of 20000, checked against tests/mem_budget. Memory
+# taken by libc, locales and the binary itself cancels out, so the budget holds
+# across hosts. Run with UPDATE_BUDGET=1 to rewrite the budget from this run
+# with 25% headroom.
+# Usage: TD=./td MEMRUN=memrun ALLOC_SO=alloc_count.so tests/mem.sh
+set -e
+. "$(dirname "$0")/../tests/lib.sh"
+BUDGET="$(realpath "$(dirname "$0")")/mem_budget"
+MEMRUN=$(realpath "$MEMRUN")
+ALLOC_SO=$(realpath "$ALLOC_SO")
+SMALL=2000
+LARGE=20000
+setup_work
+
+# Create home $WORK/$1 with $1 tasks, a peer database and a recurring task
+populate() {
+    local -x HOME="$WORK/$1"
+    local DB="$HOME/.td/td_data.db"
+    mkdir -p "$HOME/.td" "$HOME/peer/.td"
+    seed_tasks "$1" "'задача № ' || i || ' 𝄞'" \
+        "iif(i%2=0, 'заметка ' || i, NULL)"
+    seed_tag even "id%2=0"
+    (cd "$HOME/peer" && "$TD" >/dev/null)
+    (cd "$HOME" && printf 'recurring\n\n' | "$TD" -r 7 >/dev/null)
+}
+populate $SMALL
+populate $LARGE
+
+failed=0
+new_budget=""
+# Run td in home $WORK/$1 with arguments $3... and stdin $2, set rss and allocs
+# to its peak RSS and allocation count. Export uses `THREADS` workers, default
+# 4: both databases span several chunks of ids, so that's the parallel path.
+usage() {
+    local home="$WORK/$1" input=$2
+    shift 2
+    (cd "$home" && printf '%b' "$input" |
+        HOME="$home" TD_EXPORT_THREADS=${THREADS:-4} \
+        "$MEMRUN" "$ALLOC_SO" "$WORK/stats" "$TD" "$@" >/dev/null) ||
+        fail "td $* failed on $home"
+    read -r rss allocs <"$WORK/stats"
+}
+# Measure growth of td run with arguments $3... and stdin $2 as command $1
+measure() {
+    local name=$1 rss allocs rss0 allocs0
+    shift
+    usage $SMALL "$@"
+    rss0=$rss allocs0=$allocs
+    usage $LARGE "$@"
+    rss=$((rss > rss0 ? rss - rss0 : 0))
+    allocs=$((allocs > allocs0 ? allocs - allocs0 : 0))
+    # slack for RSS noise of a few hundred KiB between runs
+    new_budget+="$name $((rss * 5 / 4 + 1024)) $((allocs * 5 / 4 + 100))"$'\n'
+    local max_rss="" max_allocs=""
+    read -r max_rss max_allocs < <(awk -v n="$name" '$1 == n { print $2, $3 }' \
+        "$BUDGET") || true
+    local verdict=ok
+    if [ -z "$max_rss" ]; then
+        verdict="no budget"
+        failed=1
+    elif [ "$rss" -gt "$max_rss" ] || [ "$allocs" -gt "$max_allocs" ]; then
+        verdict="OVER BUDGET"
+        failed=1
+    fi
+    printf '%-17s +%6s KiB +%8s allocs  (budget %s KiB, %s allocs) %s\n' \
+        "$name" "$rss" "$allocs" "${max_rss:--}" "${max_allocs:--}" "$verdict"
+}
+
+measure help "" -h
+measure version "" -v
+measure list ""
+measure info "" -i 2
+measure push "pushed\\nnote\\n" -p
+measure amend "a\\namended\\n" -n -a 3
+measure drop "" -n -d 4
+measure recur "every week\\n\\n" -r 7
+measure schedules "" -S
+measure unrecur "" -u 1
+measure tag-add "" -t add 5 odd
+measure tag-rm "" -t rm 5 odd
+measure filter "" -f even
+measure report "" -R
+measure check-report "" -C
+measure export-json "" -e json
+measure export-csv "" -e csv
+THREADS=1 measure export-json-plain "" -e json
+THREADS=1 measure export-csv-plain "" -e csv
+measure sync "" -s peer/.td/td_data.db
+measure new-replica "" -N
+
+if [ -n "$UPDATE_BUDGET" ]; then
+    {
+        echo "# command max-peak-rss-growth-KiB max-allocation-growth, see tests/mem.sh"
+        printf '%s' "$new_budget"
+    } >"$BUDGET"
+    echo "mem: budget updated"
+    exit 0
+fi
+[ "$failed" -eq 0 ] || fail "memory budget exceeded"
+echo "mem: OK"
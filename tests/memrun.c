@@ -0,0 +1,62 @@
+/* Run a command and record its peak RSS and heap allocation count.
+ * Usage: memrun <alloc_count.so> <stats file> <command> [args...]
+ * Writes "<peak RSS KiB> <allocations>" to the stats file and exits with the
+ * command's status. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <alloc_count.so> <stats file> <command>\n",
+                argv[0]);
+        return 2;
+    }
+    char log[] = "/tmp/memrun.XXXXXX";
+    int fd = mkstemp(log);
+    if (fd < 0) {
+        perror("memrun: mkstemp");
+        return 2;
+    }
+    close(fd);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("memrun: fork");
+        return 2;
+    }
+    if (pid == 0) {
+        setenv("LD_PRELOAD", argv[1], 1);
+        setenv("TD_ALLOC_LOG", log, 1);
+        execvp(argv[3], argv + 3);
+        perror("memrun: exec");
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("memrun: wait4");
+        return 2;
+    }
+    unsigned long allocs = 0;
+    FILE* f = fopen(log, "r");
+    if (f == NULL || fscanf(f, "%lu", &allocs) != 1) {
+        fprintf(stderr, "memrun: no allocation count from '%s'\n", argv[3]);
+        status = 2 << 8;
+    }
+    if (f != NULL) fclose(f);
+    unlink(log);
+
+    f = fopen(argv[2], "w");
+    if (f == NULL) {
+        perror("memrun: stats file");
+        return 2;
+    }
+    fprintf(f, "%ld %lu\n", usage.ru_maxrss, allocs);
+    fclose(f);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
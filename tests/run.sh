@@ -0,0 +1,24 @@
+#!/bin/bash
+# Test driver of `make check`: runs tests/test_*.sh against the sanitized
+# binary, then tests/mem.sh against the plain one.
+# Usage: tests/run.sh <dir with td-asan, td, memrun and alloc_count.so>
+DIR=$(realpath "${1:?Usage: $0 <check build dir>}")
+TESTS=$(dirname "$0")
+# any sanitizer report fails the command with a distinct status
+export ASAN_OPTIONS=detect_leaks=1:exitcode=86
+export UBSAN_OPTIONS=halt_on_error=1:print_stacktrace=1:exitcode=87
+
+failed=()
+for t in "$TESTS"/test_*.sh; do
+    echo "== $(basename "$t")"
+    TD="$DIR/td-asan" "$t" || failed+=("$(basename "$t")")
+done
+echo "== mem.sh"
+TD="$DIR/td" MEMRUN="$DIR/memrun" ALLOC_SO="$DIR/alloc_count.so" \
+    "$TESTS/mem.sh" || failed+=(mem.sh)
+
+if [ ${#failed[@]} -ne 0 ]; then
+    echo "FAILED: ${failed[*]}"
+    exit 1
+fi
+echo "All checks passed"
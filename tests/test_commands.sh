@@ -0,0 +1,119 @@
+#!/bin/bash
+# Every command against a scratch database, including input longer than the
+# line limits and a database of many UTF-8 tasks. Meant for the sanitized
+# build, any sanitizer report fails the command it comes from.
+# Usage: [TD=./td] tests/test_commands.sh
+set -e
+. "$(dirname "$0")/../tests/lib.sh"
+setup_work
+cd "$HOME"
+
+# Repeat string $1 $2 times
+rep() {
+    local s=""
+    for ((i = 0; i < $2; ++i)); do s+="$1"; done
+    echo "$s"
+}
+
+# Run td expecting failure
+td_fails() {
+    if "$TD" "$@" >/dev/null 2>"$WORK/err"; then fail "td $* succeeded"; fi
+    if grep -q "Sanitizer\|runtime error" "$WORK/err"; then
+        cat "$WORK/err" >&2
+        fail "td $* tripped a sanitizer"
+    fi
+}
+
+"$TD" -h | grep -q -- "--export" || fail "help"
+"$TD" -v | grep -q "^td v" || fail "version"
+td_fails --bogus
+expect_eq "$("$TD")" "" "list of empty database"
+
+# names and notes at and past their limits, in 2 and 4 byte characters
+name=$(rep "𝄞" 45)
+note=$(rep "я" 300)
+printf '%s\n%s\n' "$name" "$note" | "$TD" -p >/dev/null
+expect_eq "$("$TD")" "{1} $(rep "𝄞" 40)" "list of truncated name"
+expect_eq "$("$TD" -i 1)" "{1} $(rep "𝄞" 40): $(rep "я" 200)" "info"
+printf 'Привет, "Мир"\n\n' | "$TD" -p >/dev/null
+printf '\n' | "$TD" -p >/dev/null
+expect_eq "$("$TD" | wc -l)" 2 "tasks after aborted push"
+td_fails -i 99
+td_fails -i abc
+
+printf 'a\n%s\n' "$(rep "ü" 50)" | "$TD" -n -a 2 >/dev/null
+expect_eq "$("$TD" -i 2)" "{2} $(rep "ü" 40): (null)" "amended name"
+printf 'o\nновая заметка\n' | "$TD" -n -a 2 >/dev/null
+expect_eq "$("$TD" -i 2)" "{2} $(rep "ü" 40): новая заметка" "amended note"
+printf 'a\nnot confirmed\nn\n' | "$TD" -a 2 >/dev/null
+expect_eq "$("$TD" -i 2 | grep -c "not confirmed")" 0 "unconfirmed amend"
+
+# recurring tasks, day counts out of range are rejected
+printf 'Еженедельно\n\n' | "$TD" -r 7 >/dev/null
+expect_eq "$("$TD" -S | grep -c "{1} Еженедельно (every 7 days")" 1 "schedules"
+expect_eq "$("$TD" | grep -c Еженедельно)" 1 "first recurring task"
+td_fails -r 0
+td_fails -r 36501
+td_fails -r 3000000000
+td_fails -r 99999999999999999999999
+td_fails -r 7x
+td_fails -u 99
+"$TD" -u 1 >/dev/null
+expect_eq "$("$TD" -S)" "" "schedules after unrecur"
+
+# tags
+"$TD" -t add 1 сеть,ui >/dev/null
+"$TD" -t add 2 сеть >/dev/null
+expect_eq "$("$TD" -f сеть | wc -l)" 2 "any of one tag"
+expect_eq "$("$TD" -f сеть,ui | cut -d' ' -f1)" "{1}" "all of tags"
+expect_eq "$("$TD" -f ui/нет | cut -d' ' -f1)" "{1}" "any of tags"
+expect_eq "$("$TD" -f нет)" "" "unknown tag"
+td_fails -f "a,b/c"
+td_fails -t add 99 сеть
+td_fails -t rm 99 сеть
+td_fails -t add 1 ""
+td_fails -t move 1 сеть
+"$TD" -t rm 1 ui >/dev/null
+expect_eq "$("$TD" -f ui)" "" "removed tag"
+
+# export escapes quotes and separators
+printf 'Привет, "Мир"\nnote, with comma\n' | "$TD" -p >/dev/null
+"$TD" -e json | grep -qF '"name":"Привет, \"Мир\""' || fail "json export"
+"$TD" -e csv | grep -qF '"Привет, ""Мир""","note, with comma"' ||
+    fail "csv export"
+td_fails -e xml
+
+"$TD" -n -d 4 >/dev/null
+expect_eq "$("$TD" | grep -c "{4}")" 0 "dropped task"
+printf 'n\n' | "$TD" -d 2 >/dev/null
+expect_eq "$("$TD" | grep -c "{2}")" 1 "unconfirmed drop"
+"$TD" -R | grep -q "^Closed tasks: 1$" || fail "report"
+"$TD" -C >/dev/null || fail "check-report"
+
+# sync and replica ids
+mkdir -p "$WORK/peer/.td"
+"$TD" -s "$WORK/peer/.td/td_data.db" >/dev/null 2>&1 && fail "sync with missing peer"
+(cd "$WORK/peer" && "$TD" >/dev/null)
+"$TD" -s "$WORK/peer/.td/td_data.db" | grep -q "0 received, 4 sent" || fail "sync"
+cp "$DB" "$WORK/copy.db"
+td_fails -s "$WORK/copy.db"
+"$TD" -N >/dev/null
+"$TD" -s "$WORK/copy.db" | grep -q "0 received, 0 sent" || fail "sync with copy"
+
+# local database in the current directory takes precedence
+mkdir "$WORK/proj"
+(cd "$WORK/proj" && "$TD" -l >/dev/null && "$TD" >/dev/null)
+[ -f "$WORK/proj/.td/td_data.db" ] || fail "local database"
+expect_eq "$(cd "$WORK/proj" && "$TD")" "" "list of local database"
+
+# many UTF-8 tasks with notes and tags
+seed_tasks 20000 "'задача № ' || i || ' 𝄞'" "iif(i%2=0, 'заметка ' || i, NULL)"
+seed_tag чётные "id%2=0 AND name LIKE 'задача%'"
+expect_eq "$("$TD" | wc -l)" 20003 "list of many tasks"
+expect_eq "$("$TD" -f чётные | wc -l)" 10000 "filter of many tasks"
+expect_eq "$("$TD" -e json | wc -l)" 20005 "json export of many tasks"
+expect_eq "$("$TD" -e csv | wc -l)" 20004 "csv export of many tasks"
+"$TD" -C >/dev/null || fail "check-report of many tasks"
+"$TD" -s "$WORK/peer/.td/td_data.db" | grep -q "20000 sent" ||
+    fail "sync of many tasks"
+echo "commands: OK"
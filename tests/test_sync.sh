@@ -0,0 +1,123 @@
+#!/bin/bash
+# --sync between two scratch databases: exchange, conflicts, drops, legacy
+# copies, copied replicas and cost proportional to the delta.
+# Usage: [TD=./td] tests/test_sync.sh
+set -e
+. "$(dirname "$0")/../tests/lib.sh"
+setup_work
+
+A="$WORK/a"
+B="$WORK/b"
+mkdir -p "$A/.td" "$B/.td"
+
+# Run td for the database of directory $1
+td_in() {
+    (cd "$1" && "$TD" -n "${@:2}")
+}
+
+# Sorted task names of directory $1
+names() {
+    td_in "$1" | sed 's/^{[0-9]*} //' | sort
+}
+
+# Push task named $2 with note $3 to directory $1
+push() {
+    printf '%s\n%s\n' "$2" "$3" | td_in "$1" -p >/dev/null
+}
+
+# Id of the task named $2 in directory $1
+id_of() {
+    td_in "$1" | sed -n "s/^{\([0-9]*\)} $2\$/\1/p"
+}
+
+sync_ab() {
+    td_in "$A" -s "$B/.td/td_data.db" | sed 's/.*: //'
+}
+
+# missing peer is an error, not a new database
+if td_in "$A" -s "$WORK/typo.db" >/dev/null 2>&1; then
+    fail "sync with missing peer succeeded"
+fi
+[ ! -e "$WORK/typo.db" ] || fail "sync created missing peer"
+
+push "$A" "from a" "note a"
+push "$A" "Привет, Мир!" ""
+push "$B" "from b" ""
+expect_eq "$(sync_ab)" "1 received, 2 sent" "first sync"
+expect_eq "$(names "$A")" "$(names "$B")" "tasks after first sync"
+expect_eq "$(names "$A" | wc -l)" 3 "task count after first sync"
+expect_eq "$(td_in "$B" -i "$(id_of "$B" "from a")")" \
+    "{$(id_of "$B" "from a")} from a: note a" "note after sync"
+expect_eq "$(sync_ab)" "0 received, 0 sent" "repeated sync"
+
+# both sides amend the same task, one name wins on both
+printf 'a\nfrom a, amended in a\n' | td_in "$A" -a "$(id_of "$A" "from a")" >/dev/null
+printf 'a\nfrom a, amended in b\n' | td_in "$B" -a "$(id_of "$B" "from a")" >/dev/null
+sync_ab >/dev/null
+expect_eq "$(names "$A")" "$(names "$B")" "tasks after conflicting amends"
+expect_eq "$(names "$A" | grep -c amended)" 1 "winners of conflicting amends"
+
+# drop travels as a tombstone, a drop and an amend of one task agree too
+td_in "$B" -d "$(id_of "$B" "from b")" >/dev/null
+expect_eq "$(sync_ab)" "1 received, 0 sent" "sync of drop"
+expect_eq "$(names "$A" | grep -c "from b")" 0 "dropped task in a"
+td_in "$A" -d "$(id_of "$A" "Привет, Мир!")" >/dev/null
+printf 'a\nПока, Мир!\n' | td_in "$B" -a "$(id_of "$B" "Привет, Мир!")" >/dev/null
+sync_ab >/dev/null
+expect_eq "$(names "$A")" "$(names "$B")" "tasks after drop and amend"
+expect_eq "$(sync_ab)" "0 received, 0 sent" "sync after conflicts"
+td_in "$A" -C >/dev/null || fail "report of a is off after sync"
+td_in "$B" -C >/dev/null || fail "report of b is off after sync"
+
+# copies of a database from before sync migrate separately to the same uids
+L1="$WORK/l1"
+L2="$WORK/l2"
+mkdir -p "$L1/.td" "$L2/.td"
+sqlite3 "$L1/.td/td_data.db" \
+    "CREATE TABLE tasks (id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT, note TEXT);
+     INSERT INTO tasks (name, note) VALUES ('shared1', 'n'), ('shared2', NULL);"
+cp "$L1/.td/td_data.db" "$L2/.td/td_data.db"
+td_in "$L1" >/dev/null
+push "$L2" "after copy" ""
+expect_eq "$(td_in "$L1" -s "$L2/.td/td_data.db" | sed 's/.*: //')" \
+    "1 received, 0 sent" "sync of legacy copies"
+expect_eq "$(names "$L1")" "$(printf 'after copy\nshared1\nshared2')" \
+    "tasks of legacy copies"
+
+# tasks of unknown creation time stay so on the receiving side
+E="$WORK/e"
+mkdir -p "$E/.td"
+td_in "$E" >/dev/null
+td_in "$L1" -s "$E/.td/td_data.db" >/dev/null
+expect_eq "$(sqlite3 "$E/.td/td_data.db" \
+    "SELECT count(*) FROM tasks WHERE created IS NULL;")" 2 \
+    "synced tasks without creation time"
+td_in "$E" -C >/dev/null || fail "report of e is off after sync"
+td_in "$E" -R | grep -q "^Open tasks: 3$" || fail "report of e"
+
+# copy of a migrated database needs a new replica id first
+C="$WORK/c"
+mkdir -p "$C/.td"
+cp "$A/.td/td_data.db" "$C/.td/td_data.db"
+if td_in "$C" -s "$A/.td/td_data.db" >/dev/null 2>&1; then
+    fail "sync with a copy succeeded"
+fi
+td_in "$C" -N >/dev/null
+expect_eq "$(td_in "$C" -s "$A/.td/td_data.db" | sed 's/.*: //')" \
+    "0 received, 0 sent" "sync with a renamed copy"
+push "$C" "from c" ""
+expect_eq "$(td_in "$C" -s "$A/.td/td_data.db" | sed 's/.*: //')" \
+    "0 received, 1 sent" "sync of a change of a copy"
+
+# after the first sync only the delta is read
+DB="$A/.td/td_data.db" seed_tasks 20000 "'bulk ' || i"
+start=$(now_ms)
+expect_eq "$(sync_ab)" "0 received, 20001 sent" "bulk sync"
+full=$(($(now_ms) - start))
+push "$A" "one more" ""
+start=$(now_ms)
+expect_eq "$(sync_ab)" "0 received, 1 sent" "delta sync"
+delta=$(($(now_ms) - start))
+echo "sync: 20001 changes $full ms, 1 change $delta ms"
+[ $((delta * 5)) -lt "$full" ] || fail "delta sync isn't cheaper than full"
+echo "sync: OK"